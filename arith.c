@@ -0,0 +1,348 @@
+/* Arithmetic expressions, as in $(( expression )) and the let builtin.
+ *
+ * Expressions are evaluated directly while they are parsed, by recursive
+ * descent and precedence climbing, on 64-bit signed integers.  The operators are those of C,
+ * with the same precedence:
+ *
+ *	( )  ++ -- (postfix)  + - ! ~ ++ -- (prefix)  * / %  + -  << >>
+ *	< <= > >=  == !=  &  ^  |  &&  ||  ?:  = *= /= %= += -= <<= >>= &= ^= |=
+ *
+ * Numbers are decimal, octal (leading 0) or hexadecimal (leading 0x).
+ * A name refers to a variable, optionally written as $name; a variable
+ * that is not set or not a number counts as 0.  The operands of &&, ||
+ * and ?: that are not needed are parsed but not evaluated, so they do
+ * not assign to variables or divide by zero.
+ *
+ * The interface is as follows:
+ *	int arith_eval(const char *expr, long long *result):
+ *		Evaluate the expression.  Returns -1 after printing a message
+ *		if it is not valid.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "shall.h"
+
+struct arith {
+	const char *expr;		// the whole expression, for messages
+	const char *p;			// next character
+	int noeval;				// parsing only, do not evaluate
+	int error;
+};
+
+/* An lvalue, if the last operand parsed was a variable.
+ */
+struct value {
+	long long n;
+	const char *name;		// 0 if not a variable
+	unsigned int len;
+};
+
+static void arith_error(struct arith *a, const char *msg){
+	if (!a->error) {
+		if (*a->p == 0) {
+			fprintf(stderr, "%s: %s\n", a->expr, msg);
+		}
+		else {
+			fprintf(stderr, "%s: %s (at '%s')\n", a->expr, msg, a->p);
+		}
+		a->error = 1;
+	}
+}
+
+static void skip(struct arith *a){
+	while (isspace((unsigned char) *a->p)) {
+		a->p++;
+	}
+}
+
+/* If the operator op comes next, and is not the start of a longer one
+ * given in 'not', consume it.
+ */
+static int next(struct arith *a, const char *op, const char *not){
+	size_t len;
+
+	skip(a);
+	if (*a->p != op[0]) {		// the common case, without the library calls
+		return 0;
+	}
+	len = strlen(op);
+	if (strncmp(a->p, op, len) != 0) {
+		return 0;
+	}
+	if (not != 0 && a->p[len] != 0 && strchr(not, a->p[len]) != 0) {
+		return 0;
+	}
+	a->p += len;
+	return 1;
+}
+
+static long long var_value(const char *name, unsigned int len){
+	char *s = var_get(name, len);
+
+	return s == 0 ? 0 : strtoll(s, 0, 0);
+}
+
+static void assign(struct arith *a, struct value *v, long long n){
+	char name[v->len + 1], num[32];
+
+	if (v->name == 0) {
+		arith_error(a, "assignment to a non-variable");
+		return;
+	}
+	if (!a->noeval) {
+		memcpy(name, v->name, v->len);
+		name[v->len] = 0;
+		snprintf(num, sizeof(num), "%lld", n);
+		var_set(name, num);
+	}
+	v->n = n;
+	v->name = 0;
+}
+
+static struct value assignment(struct arith *a);
+
+static struct value primary(struct arith *a){
+	struct value v = { 0, 0, 0 };
+
+	skip(a);
+	if (*a->p == '(') {
+		a->p++;
+		v = assignment(a);
+		v.name = 0;
+		if (!next(a, ")", 0)) {
+			arith_error(a, "missing ')'");
+		}
+	}
+	else if (isdigit((unsigned char) *a->p)) {
+		char *end;
+		v.n = strtoll(a->p, &end, 0);
+		if (isalnum((unsigned char) *end) || *end == '_') {
+			arith_error(a, "bad number");
+		}
+		a->p = end;
+	}
+	else {
+		if (*a->p == '$') {
+			a->p++;
+		}
+		const char *name = a->p;
+		while (isalnum((unsigned char) *a->p) || *a->p == '_') {
+			a->p++;
+		}
+		if (a->p == name || !var_name(name, a->p - name)) {
+			arith_error(a, "syntax error");
+			return v;
+		}
+		v.name = name;
+		v.len = a->p - name;
+		v.n = a->noeval ? 0 : var_value(name, v.len);
+	}
+	return v;
+}
+
+static struct value postfix(struct arith *a){
+	struct value v = primary(a);
+
+	if (next(a, "++", 0)) {
+		long long n = v.n;
+		assign(a, &v, n + 1);
+		v.n = n;
+	}
+	else if (next(a, "--", 0)) {
+		long long n = v.n;
+		assign(a, &v, n - 1);
+		v.n = n;
+	}
+	return v;
+}
+
+static struct value unary(struct arith *a){
+	struct value v;
+
+	skip(a);
+	if (*a->p == 0 || strchr("+-!~", *a->p) == 0) {
+		return postfix(a);
+	}
+	if (next(a, "++", 0)) {
+		v = unary(a);
+		assign(a, &v, v.n + 1);
+	}
+	else if (next(a, "--", 0)) {
+		v = unary(a);
+		assign(a, &v, v.n - 1);
+	}
+	else if (next(a, "+", 0)) {
+		v = unary(a);
+		v.name = 0;
+	}
+	else if (next(a, "-", 0)) {
+		v = unary(a);
+		v.n = -(unsigned long long) v.n;
+		v.name = 0;
+	}
+	else if (next(a, "!", "=")) {
+		v = unary(a);
+		v.n = !v.n;
+		v.name = 0;
+	}
+	else if (next(a, "~", 0)) {
+		v = unary(a);
+		v.n = ~v.n;
+		v.name = 0;
+	}
+	else {
+		v = postfix(a);
+	}
+	return v;
+}
+
+/* The binary and assignment operators.  Longer operators come before
+ * their prefixes.  The binary operators are parsed by precedence climbing,
+ * so that an operand costs one scan() rather than a call for each level
+ * of precedence.
+ */
+static const struct op {
+	char name[4];
+	int len;
+	int prec;			// precedence as a binary operator, 0 if it is not one
+	int code;			// see binop()
+	int assign;			// an assignment, compound if code is set
+} ops[] = {
+	{ "<<=", 3, 0, '<', 1 }, { ">>=", 3, 0, '>', 1 },
+	{ "||", 2, 1, 'o', 0 }, { "&&", 2, 2, 'a', 0 },
+	{ "==", 2, 6, '=', 0 }, { "!=", 2, 6, '!', 0 },
+	{ "<=", 2, 7, 'L', 0 }, { ">=", 2, 7, 'G', 0 },
+	{ "<<", 2, 8, '<', 0 }, { ">>", 2, 8, '>', 0 },
+	{ "*=", 2, 0, '*', 1 }, { "/=", 2, 0, '/', 1 }, { "%=", 2, 0, '%', 1 },
+	{ "+=", 2, 0, '+', 1 }, { "-=", 2, 0, '-', 1 }, { "&=", 2, 0, '&', 1 },
+	{ "^=", 2, 0, '^', 1 }, { "|=", 2, 0, '|', 1 },
+	{ "|", 1, 3, '|', 0 }, { "^", 1, 4, '^', 0 }, { "&", 1, 5, '&', 0 },
+	{ "<", 1, 7, 'l', 0 }, { ">", 1, 7, 'g', 0 },
+	{ "+", 1, 9, '+', 0 }, { "-", 1, 9, '-', 0 },
+	{ "*", 1, 10, '*', 0 }, { "/", 1, 10, '/', 0 }, { "%", 1, 10, '%', 0 },
+	{ "=", 1, 0, 0, 1 },
+	{ "", 0, 0, 0, 0 }
+};
+
+/* Return the operator that comes next, without consuming it, or 0.
+ */
+static const struct op *scan(struct arith *a){
+	const struct op *op;
+
+	skip(a);
+	for (op = ops; op->len != 0; op++) {
+		if (op->name[0] == a->p[0] && strncmp(op->name, a->p, op->len) == 0) {
+			return op;
+		}
+	}
+	return 0;
+}
+
+/* Apply a binary operator.  Also used for the compound assignments.
+ */
+static long long binop(struct arith *a, int op, long long x, long long y){
+	switch (op) {
+	case '*': return (unsigned long long) x * y;
+	case '+': return (unsigned long long) x + y;
+	case '-': return (unsigned long long) x - y;
+	case '<': return (unsigned long long) x << (y & 63);
+	case '>': return x >> (y & 63);
+	case '&': return x & y;
+	case '^': return x ^ y;
+	case '|': return x | y;
+	case 'l': return x < y;
+	case 'L': return x <= y;
+	case 'g': return x > y;
+	case 'G': return x >= y;
+	case '=': return x == y;
+	case '!': return x != y;
+	case 'a': return x && y;
+	case 'o': return x || y;
+	case '/': case '%':
+		if (y == 0) {
+			if (!a->noeval) {
+				arith_error(a, "division by zero");
+			}
+			return 0;
+		}
+		if (y == -1) {		// avoid the overflow trap of LLONG_MIN / -1
+			return op == '/' ? -(unsigned long long) x : 0;
+		}
+		return op == '/' ? x / y : x % y;
+	}
+	return 0;
+}
+
+/* Parse operands joined by binary operators of at least the given
+ * precedence.  The right operand of && and || is not evaluated if the
+ * left one decides the result.
+ */
+static struct value binary(struct arith *a, int prec){
+	struct value v = unary(a);
+	const struct op *op;
+
+	while ((op = scan(a)) != 0 && op->prec >= prec) {
+		int noeval = a->noeval;
+		a->p += op->len;
+		if ((op->code == 'a' && !v.n) || (op->code == 'o' && v.n)) {
+			a->noeval = 1;
+		}
+		long long n = binary(a, op->prec + 1).n;
+		a->noeval = noeval;
+		v.n = binop(a, op->code, v.n, n);
+		v.name = 0;
+	}
+	return v;
+}
+
+static struct value conditional(struct arith *a){
+	struct value v = binary(a, 1);
+
+	if (next(a, "?", 0)) {
+		int noeval = a->noeval;
+		a->noeval = noeval || !v.n;
+		struct value t = assignment(a);
+		if (!next(a, ":", 0)) {
+			arith_error(a, "missing ':'");
+		}
+		a->noeval = noeval || v.n;
+		struct value f = conditional(a);
+		a->noeval = noeval;
+		v.n = v.n ? t.n : f.n;
+		v.name = 0;
+	}
+	return v;
+}
+
+static struct value assignment(struct arith *a){
+	struct value v = conditional(a);
+	const struct op *op = scan(a);
+
+	if (op != 0 && op->assign) {
+		a->p += op->len;
+		struct value r = assignment(a);
+		assign(a, &v, op->code == 0 ? r.n : binop(a, op->code, v.n, r.n));
+	}
+	return v;
+}
+
+int arith_eval(const char *expr, long long *result){
+	struct arith a;
+
+	memset(&a, 0, sizeof(a));
+	a.expr = a.p = expr;
+	skip(&a);
+	if (*a.p == 0) {
+		*result = 0;
+		return 0;
+	}
+	*result = assignment(&a).n;
+	skip(&a);
+	if (*a.p != 0) {
+		arith_error(&a, "syntax error");
+	}
+	return a.error ? -1 : 0;
+}
@@ -0,0 +1,333 @@
+/* Loops and blocks.
+ *
+ * Commands arrive here one at a time from interpret().  Normally they
+ * are expanded and performed right away, but between 'while' and the
+ * matching 'done', or 'begin' and the matching 'end', they are
+ * collected into a tree of nodes, which is executed once the outermost
+ * loop or block is complete:
+ *
+ *	while command...; do command...; done [redirections]
+ *
+ * The loop runs the body as long as the last of the condition commands
+ * returns status 0, and no interrupt has arrived since the outermost
+ * loop started.  The redirections on 'done' are applied once, to
+ * the shall itself, for the whole loop, so that for example
+ *
+ *	while read line; do echo $line; done < file
+ *
+ * reads the file through a single buffered reader.  The keywords may
+ * be followed by a command on the same line, as in 'while read x' and
+ * 'do echo $x'.
+ *
+ * A block runs its commands once, with the redirections on 'end'
+ * applied in the same way:
+ *
+ *	begin command...; end [redirections]
+ *
+ * so that in 'begin date; ls; end > log' the file is opened once rather
+ * than by every command, and the commands inherit it.  ('{' cannot
+ * group commands, as it is taken by the '{fd}' syntax.)
+ *
+ * The commands of a pipeline are collected in the same way until the
+ * last one arrives, and then run together.  Loops and blocks run in the
+ * shall itself, so they cannot be part of a pipeline.
+ *
+ * The interface is as follows:
+ *	block_t block_create():
+ *		Create a block.  Each interpret() has its own.
+ *
+ *	int block_command(block_t block, command_t command, int background):
+ *		Handle the next command.  Returns its exit status, or 0 if
+ *		it was only collected.
+ *
+ *	void block_pipe_cancel(block_t block):
+ *		Drop the commands of a pipeline that is being collected.
+ *
+ *	void block_free(block_t block):
+ *		Release the block.  Complains about unfinished loops and
+ *		blocks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shall.h"
+
+#define MAX_NESTING		32
+
+struct node {
+	enum { NODE_COMMAND, NODE_WHILE, NODE_BEGIN } type;
+	int background;
+	struct command command;		// the command, or the redirections of a loop
+	struct node *cond, *body;	// loop condition and body, or block body
+	struct node *next;
+};
+
+struct block {
+	/* Loops and blocks that are being collected, innermost last.
+	 */
+	struct {
+		struct node *node;
+		struct node **tail;		// where to add the next command
+		int inbody;				// 'do' has been seen
+	} stack[MAX_NESTING];
+	int depth;
+
+	/* Commands of a pipeline outside loops, until the last one arrives.
+	 */
+	struct node *pipeline, **pipetail;
+
+	struct command expanded;	// scratch space for expanding commands
+	struct command *stages;		// same, for the commands of a pipeline
+	command_t *stagev;
+	int maxstages;
+};
+
+block_t block_create(){
+	return mem_calloc(MEM_SHALL, sizeof(struct block));
+}
+
+static void node_free(struct node *node){
+	while (node != 0) {
+		struct node *next = node->next;
+		node_free(node->cond);
+		node_free(node->body);
+		command_free(&node->command);
+		mem_free(node);
+		node = next;
+	}
+}
+
+/* Expand and perform a simple command.
+ */
+static int block_perform(block_t block, command_t command, int background){
+	if (!command->expand) {
+		return perform(command, background);
+	}
+	if (expand(&block->expanded, command) < 0) {
+		return last_status = 1;
+	}
+	command_finish(&block->expanded);
+	return perform(&block->expanded, background);
+}
+
+static int node_run(block_t block, struct node *node);
+
+/* Expand and perform the pipeline that starts at *pnode, and set *pnode
+ * to its last command.
+ */
+static int pipeline_run(block_t block, struct node **pnode){
+	struct node *first = *pnode, *last, *node;
+	int n = 1, i, status, error = 0;
+
+	for (last = first; last->command.pipemore && last->next != 0
+							&& last->next->type == NODE_COMMAND; last = last->next) {
+		n++;
+	}
+	if (n > block->maxstages) {
+		block->stages = mem_realloc(MEM_SHALL, block->stages, n * sizeof(*block->stages));
+		memset(&block->stages[block->maxstages], 0, (n - block->maxstages) * sizeof(*block->stages));
+		block->stagev = mem_realloc(MEM_SHALL, block->stagev, n * sizeof(*block->stagev));
+		block->maxstages = n;
+	}
+
+	for (node = first, i = 0; i < n; node = node->next, i++) {
+		command_finish(&node->command);
+		block->stagev[i] = &node->command;
+		if (!error && node->command.expand) {
+			if (expand(&block->stages[i], &node->command) < 0) {
+				error = 1;
+			}
+			command_finish(&block->stages[i]);
+			block->stagev[i] = &block->stages[i];
+		}
+	}
+	status = error ? (last_status = 1) : perform_pipeline(block->stagev, n, last->background);
+	for (node = first, i = 0; i < n; node = node->next, i++) {
+		node->command.argc--;
+	}
+	*pnode = last;
+	return status;
+}
+
+/* Run a list of nodes, returning the status of the last one.
+ */
+static int list_run(block_t block, struct node *node){
+	int status = 0;
+
+	for (; node != 0; node = node->next) {
+		if (node->type == NODE_COMMAND && node->command.pipemore) {
+			status = pipeline_run(block, &node);
+		}
+		else {
+			status = node_run(block, node);
+		}
+	}
+	return status;
+}
+
+static int node_run(block_t block, struct node *node){
+	if (node->type == NODE_COMMAND) {
+		command_finish(&node->command);
+		int status = block_perform(block, &node->command, node->background);
+		node->command.argc--;
+		return status;
+	}
+
+	struct fdsave save;
+	int status = 0;
+
+	if (node->command.expand && expand(&block->expanded, &node->command) < 0) {
+		return last_status = 1;
+	}
+	if (redirect_push(node->command.expand ? &block->expanded : &node->command, &save) == 0) {
+		if (node->type == NODE_BEGIN) {
+			status = list_run(block, node->body);
+		}
+		else {
+			while (!interrupts_pending() && list_run(block, node->cond) == 0) {
+				status = list_run(block, node->body);
+			}
+		}
+	}
+	else {
+		status = 1;
+	}
+	redirect_pop(&save);
+	last_status = status;
+	return status;
+}
+
+/* Add the arguments of command from argv[first] on, and its redirections,
+ * to the innermost loop or block being collected.
+ */
+static void block_add(block_t block, command_t command, int first, int background){
+	if (command->argv[first] == 0 && command->nredirs == 0) {
+		return;
+	}
+
+	struct node *node = mem_calloc(MEM_SHALL, sizeof(*node));
+	node->type = NODE_COMMAND;
+	node->background = background;
+	command_copy(&node->command, command, first);
+	*block->stack[block->depth - 1].tail = node;
+	block->stack[block->depth - 1].tail = &node->next;
+}
+
+/* Return the type of the innermost loop or block being collected, or
+ * NODE_COMMAND if there is none.
+ */
+static int block_inner(block_t block){
+	return block->depth == 0 ? NODE_COMMAND : block->stack[block->depth - 1].node->type;
+}
+
+int block_command(block_t block, command_t command, int background){
+	char *keyword = command->argv[0];
+	int start = strcmp(keyword, "while") == 0 || strcmp(keyword, "begin") == 0;
+	int end = strcmp(keyword, "done") == 0 || strcmp(keyword, "end") == 0;
+
+	if ((start || end || strcmp(keyword, "do") == 0) && command->pipein != 0) {
+		fprintf(stderr, "can't pipe into loops or blocks\n");
+		block_pipe_cancel(block);
+		return 1;
+	}
+	if (end && command->pipemore) {
+		fprintf(stderr, "can't pipe loops or blocks\n");
+		command->pipemore = 0;
+	}
+
+	if (start) {
+		if (block->depth == MAX_NESTING) {
+			fprintf(stderr, "loops nested too deeply\n");
+			return 1;
+		}
+		struct node *node = mem_calloc(MEM_SHALL, sizeof(*node));
+		node->type = keyword[0] == 'w' ? NODE_WHILE : NODE_BEGIN;
+		if (block->depth > 0) {
+			*block->stack[block->depth - 1].tail = node;
+			block->stack[block->depth - 1].tail = &node->next;
+		}
+		block->stack[block->depth].node = node;
+		block->stack[block->depth].tail = node->type == NODE_WHILE ? &node->cond : &node->body;
+		block->stack[block->depth].inbody = node->type == NODE_BEGIN;
+		block->depth++;
+		block_add(block, command, 1, background);
+		return 0;
+	}
+	if (strcmp(keyword, "do") == 0) {
+		if (block_inner(block) != NODE_WHILE || block->stack[block->depth - 1].inbody
+							|| block->stack[block->depth - 1].node->cond == 0) {
+			fprintf(stderr, "unexpected 'do'\n");
+			return 1;
+		}
+		block->stack[block->depth - 1].inbody = 1;
+		block->stack[block->depth - 1].tail = &block->stack[block->depth - 1].node->body;
+		block_add(block, command, 1, background);
+		return 0;
+	}
+	if (end) {
+		if (block_inner(block) != (keyword[1] == 'o' ? NODE_WHILE : NODE_BEGIN)
+							|| !block->stack[block->depth - 1].inbody) {
+			fprintf(stderr, "unexpected '%s'\n", keyword);
+			return 1;
+		}
+		if (command->argv[1] != 0) {
+			fprintf(stderr, "unexpected arguments after '%s'\n", keyword);
+		}
+		if (background) {
+			fprintf(stderr, "can't run loops or blocks in background\n");
+		}
+		struct node *node = block->stack[--block->depth].node;
+		command_copy(&node->command, command, command->argc);
+		if (block->depth > 0) {
+			return 0;
+		}
+		interrupts_reset();
+		int status = node_run(block, node);
+		node_free(node);
+		return status;
+	}
+
+	if (block->depth > 0) {
+		block_add(block, command, 0, background);
+		return 0;
+	}
+	if (command->pipemore || block->pipeline != 0) {
+		struct node *node = mem_calloc(MEM_SHALL, sizeof(*node));
+		node->type = NODE_COMMAND;
+		node->background = background;
+		command_copy(&node->command, command, 0);
+		if (block->pipeline == 0) {
+			block->pipetail = &block->pipeline;
+		}
+		*block->pipetail = node;
+		block->pipetail = &node->next;
+		if (command->pipemore) {
+			return 0;
+		}
+		int status = list_run(block, block->pipeline);
+		block_pipe_cancel(block);
+		return status;
+	}
+	return block_perform(block, command, background);
+}
+
+void block_pipe_cancel(block_t block){
+	node_free(block->pipeline);
+	block->pipeline = 0;
+}
+
+void block_free(block_t block){
+	if (block->depth > 0) {
+		fprintf(stderr, "missing '%s'\n", block_inner(block) == NODE_WHILE ? "done" : "end");
+		node_free(block->stack[0].node);
+	}
+	block_pipe_cancel(block);
+	command_free(&block->expanded);
+	while (block->maxstages > 0) {
+		command_free(&block->stages[--block->maxstages]);
+	}
+	mem_free(block->stages);
+	mem_free(block->stagev);
+	mem_free(block);
+}
@@ -0,0 +1,224 @@
+/* Named buffers in memory.
+ *
+ * A redirection to or from 'buf:NAME' rather than a file name uses a
+ * buffer of the shall instead of a file on disk:
+ *
+ *	sort data >buf:sorted
+ *	uniq -c <buf:sorted
+ *	head <buf:sorted
+ *
+ * A buffer is a memfd_create() file, created by the first redirection
+ * that writes to it and kept open by the shall until 'buffree NAME'.
+ * Every redirection opens it anew through /proc/self/fd, so each reader
+ * starts at the beginning and has an offset of its own, and '>' truncates
+ * it as it would a file.  'exec {FD}<buf:NAME' works as well.  Nothing of
+ * this touches the filesystem.
+ *
+ * The buffers may take up to a total set with -B, 64M by default.  The
+ * total is checked when a buffer is opened for writing, so one command
+ * can write beyond it, but the next one that writes to a buffer fails
+ * until some are freed.
+ *
+ * The interface is as follows:
+ *	int buf_open(const char *file, int flags):
+ *		Open the file, or the buffer if file is 'buf:NAME', with the
+ *		given open() flags and close-on-exec.  Returns the file
+ *		descriptor, or -1 after complaining.
+ *
+ *	void buf_prepare(command_t command):
+ *		Create the buffers that the command writes to.  Called before
+ *		forking, so that they are created in the shall rather than in
+ *		the child.
+ *
+ *	int buf_setmax(const char *size):
+ *		Set the total size of the buffers from a number of bytes with
+ *		an optional k, m or g.  Returns -1 if it is invalid.
+ *
+ *	int buffree(command_t command):
+ *		The builtin: 'buffree NAME ...' frees the buffers, 'buffree'
+ *		lists them.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include "shall.h"
+
+#define BUF_PREFIX		"buf:"
+#define BUF_PREFIXLEN	4
+
+static struct buffer {
+	char *name;
+	int fd;
+} *buffers;
+static int nbuffers, maxbuffers;
+
+static unsigned long long bufmax = 64ULL << 20;
+
+static int buf_find(const char *name){
+	int i;
+
+	for (i = 0; i < nbuffers; i++) {
+		if (strcmp(buffers[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static unsigned long long buf_size(int i){
+	struct stat st;
+
+	return fstat(buffers[i].fd, &st) < 0 ? 0 : st.st_size;
+}
+
+static int buf_create(const char *name){
+	int fd = memfd_create(name, MFD_CLOEXEC);
+
+	if (fd < 0) {
+		perror("memfd_create");
+		return -1;
+	}
+	if (nbuffers == maxbuffers) {
+		maxbuffers = maxbuffers == 0 ? 8 : maxbuffers * 2;
+		buffers = mem_realloc(MEM_EXEC, buffers, maxbuffers * sizeof(*buffers));
+	}
+	buffers[nbuffers].name = mem_alloc(MEM_EXEC, strlen(name) + 1);
+	strcpy(buffers[nbuffers].name, name);
+	buffers[nbuffers].fd = fd;
+	return nbuffers++;
+}
+
+/* Open buffer i with the given flags, at an offset of its own.  Without
+ * /proc, share the offset of the shall's descriptor, put at the start.
+ */
+static int buf_reopen(int i, int flags){
+	char path[32];
+	int fd;
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", buffers[i].fd);
+	if ((fd = open(path, (flags & ~O_CREAT) | O_CLOEXEC)) >= 0) {
+		return fd;
+	}
+	if ((fd = fcntl(buffers[i].fd, F_DUPFD_CLOEXEC, 0)) < 0) {
+		perror(buffers[i].name);
+		return -1;
+	}
+	if (flags & O_TRUNC) {
+		ftruncate(fd, 0);
+	}
+	lseek(fd, 0, (flags & O_APPEND) ? SEEK_END : SEEK_SET);
+	return fd;
+}
+
+int buf_open(const char *file, int flags){
+	const char *name = file + BUF_PREFIXLEN;
+	unsigned long long total = 0;
+	int i, j, fd;
+
+	if (strncmp(file, BUF_PREFIX, BUF_PREFIXLEN) != 0) {
+		if ((fd = open(file, flags | O_CLOEXEC, 0644)) < 0) {
+			perror(file);
+		}
+		return fd;
+	}
+	if (*name == 0) {
+		fprintf(stderr, "%s: missing buffer name\n", file);
+		return -1;
+	}
+	if ((i = buf_find(name)) < 0) {
+		if (!(flags & O_CREAT)) {
+			fprintf(stderr, "%s: no such buffer\n", file);
+			return -1;
+		}
+		if ((i = buf_create(name)) < 0) {
+			return -1;
+		}
+	}
+	if ((flags & O_ACCMODE) != O_RDONLY) {
+		for (j = 0; j < nbuffers; j++) {
+			if (j != i || !(flags & O_TRUNC)) {
+				total += buf_size(j);
+			}
+		}
+		if (total >= bufmax) {
+			fprintf(stderr, "%s: buffers are full (%llu bytes), use buffree\n", file, total);
+			return -1;
+		}
+	}
+	return buf_reopen(i, flags);
+}
+
+void buf_prepare(command_t command){
+	int i;
+
+	for (i = 0; i < command->nredirs; i++) {
+		struct redir *rd = &command->redirs[i];
+		const char *file = redir_name(command, rd);
+		if ((rd->type == ELEMENT_REDIR_FILE_OUT || rd->type == ELEMENT_REDIR_FILE_APPEND)
+						&& strncmp(file, BUF_PREFIX, BUF_PREFIXLEN) == 0
+						&& file[BUF_PREFIXLEN] != 0 && buf_find(file + BUF_PREFIXLEN) < 0) {
+			buf_create(file + BUF_PREFIXLEN);
+		}
+	}
+}
+
+int buf_setmax(const char *size){
+	char *end;
+	unsigned long long n = strtoull(size, &end, 10);
+
+	if (end == size) {
+		return -1;
+	}
+	switch (*end) {
+	case 'g': case 'G':
+		n <<= 10;
+		/* FALLTHROUGH */
+	case 'm': case 'M':
+		n <<= 10;
+		/* FALLTHROUGH */
+	case 'k': case 'K':
+		n <<= 10;
+		end++;
+	}
+	if (*end != 0 || n == 0) {
+		return -1;
+	}
+	bufmax = n;
+	return 0;
+}
+
+int buffree(command_t command){
+	unsigned long long total = 0, size;
+	int i, j, status = 0;
+
+	if (command->argc == 2) {
+		for (i = 0; i < nbuffers; i++) {
+			total += size = buf_size(i);
+			printf("%s%s: %llu bytes\n", BUF_PREFIX, buffers[i].name, size);
+		}
+		printf("%llu of %llu bytes used\n", total, bufmax);
+		fflush(stdout);
+		return 0;
+	}
+	for (i = 1; command->argv[i] != 0; i++) {
+		const char *name = command->argv[i];
+		if (strncmp(name, BUF_PREFIX, BUF_PREFIXLEN) == 0) {
+			name += BUF_PREFIXLEN;
+		}
+		if ((j = buf_find(name)) < 0) {
+			fprintf(stderr, "buffree: %s: no such buffer\n", name);
+			status = 1;
+			continue;
+		}
+		close(buffers[j].fd);
+		mem_free(buffers[j].name);
+		buffers[j] = buffers[--nbuffers];
+	}
+	return status;
+}
@@ -0,0 +1,417 @@
+/* Checking a script without running it, for 'shall -n script'.
+ *
+ * The whole script is tokenized and parsed, with the parser in check
+ * mode so that every error is reported rather than the first of a line.
+ * The loop and block keywords are matched up, and then the rest of each
+ * command is looked at:
+ *
+ *	- the command name must be a builtin (builtin_find() in exec.c), or an
+ *	  executable in $PATH
+ *	- a file that input is redirected from must be readable, unless an
+ *	  earlier line creates it with '>'
+ *	- a file that output is redirected to must be writable, or else its
+ *	  directory must be
+ *
+ * Names that contain variables are only known when the script runs, and
+ * are not checked.  Each distinct check is done once, however often it
+ * occurs in the script, and the checks are done after parsing by a pool
+ * of threads, as for a large script they are mostly waiting for the file
+ * system.  Their failures are reported in the order of the script, after
+ * the errors found while parsing.
+ *
+ * The interface is as follows:
+ *	int check_script(int fd):
+ *		Check the script read from fd.  Returns 0 if no problems were
+ *		found, or 1 after reporting them on standard error.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "shall.h"
+
+#define CHECK_BUCKETS	4096
+#define CHECK_THREADS	16
+
+enum check_type { CHECK_COMMAND, CHECK_INPUT, CHECK_OUTPUT };
+
+/* A distinct check, with the line where it is first needed.
+ */
+struct check {
+	enum check_type type;
+	char *name;
+	unsigned int line;
+	int error;				// errno after the check, 0 if it passed
+	int created;			// an output file that '>' creates
+	struct check *next;		// in its hash bucket
+};
+
+static struct check **checks;			// in the order of the script
+static unsigned int nchecks, maxchecks;
+static struct check *buckets[CHECK_BUCKETS];
+static unsigned int nextcheck;			// next check for a thread to do
+static const char *checkpath;			// $PATH
+
+static unsigned int check_hash(enum check_type type, const char *name){
+	unsigned int h = 5381 + type;
+	const char *p;
+
+	for (p = name; *p != 0; p++) {
+		h = h * 33 + (unsigned char) *p;
+	}
+	return h % CHECK_BUCKETS;
+}
+
+static struct check *check_find(enum check_type type, const char *name){
+	struct check *c;
+
+	for (c = buckets[check_hash(type, name)]; c != 0; c = c->next) {
+		if (c->type == type && strcmp(c->name, name) == 0) {
+			return c;
+		}
+	}
+	return 0;
+}
+
+/* Add a check unless the same one is already there, and return it.  A
+ * file that an earlier line creates with '>' need not exist yet, so
+ * input from it is not checked, and 0 is returned.
+ */
+static struct check *check_add(enum check_type type, const char *name, unsigned int line){
+	unsigned int h = check_hash(type, name);
+	struct check *c;
+
+	if ((c = check_find(type, name)) != 0) {
+		return c;
+	}
+	if (type == CHECK_INPUT && (c = check_find(CHECK_OUTPUT, name)) != 0 && c->created) {
+		return 0;
+	}
+
+	c = malloc(sizeof(*c));
+	c->type = type;
+	c->name = strdup(name);
+	c->line = line;
+	c->error = 0;
+	c->created = 0;
+	c->next = buckets[h];
+	buckets[h] = c;
+	if (nchecks == maxchecks) {
+		maxchecks = maxchecks == 0 ? 256 : maxchecks * 2;
+		checks = realloc(checks, maxchecks * sizeof(*checks));
+	}
+	checks[nchecks++] = c;
+	return c;
+}
+
+/* Return 1 if the string has to be expanded, and so cannot be checked.
+ */
+static int check_expands(const char *s){
+	for (; *s != 0; s++) {
+		if (*s > 0 && *s <= CTL_MAX && *s != CTL_ESC) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Copy s without the CTL_ESC characters.
+ */
+static char *check_unescape(const char *s, char *buf){
+	char *p = buf;
+
+	for (; *s != 0; s++) {
+		if (*s == CTL_ESC) {
+			s++;
+		}
+		*p++ = *s;
+	}
+	*p = 0;
+	return buf;
+}
+
+/* Queue the checks for a command.  first is the index of its name,
+ * which is past the loop keyword if there is one.
+ */
+static void check_command(command_t command, int first, unsigned int line){
+	char *name = command->argv[first];
+	int i;
+
+	if (name != 0 && !check_expands(name)) {
+		char buf[strlen(name) + 1];
+		check_unescape(name, buf);
+		char *eq = strchr(buf, '=');
+		if (strcmp(buf, "in") == 0) {
+			return;			// names are relative to another directory
+		}
+		if (strcmp(buf, "exec") == 0 && command->argv[first + 1] != 0) {
+			check_command(command, first + 1, line);
+			return;
+		}
+		if (strcmp(buf, "source") == 0) {
+			for (i = first + 1; command->argv[i] != 0; i++) {
+				char *arg = command->argv[i];
+				if (strcmp(arg, "-p") == 0 && command->argv[i + 1] != 0) {
+					i++;		// the number of files at a time
+				}
+				else if (arg[0] != '-' && !check_expands(arg)) {
+					char file[strlen(arg) + 1];
+					check_add(CHECK_INPUT, check_unescape(arg, file), line);
+				}
+			}
+		}
+		else if (builtin_find(buf) < 0 && (eq == 0 || !var_name(buf, eq - buf))) {
+			check_add(CHECK_COMMAND, buf, line);
+		}
+	}
+
+	for (i = 0; i < command->nredirs; i++) {
+		struct redir *r = &command->redirs[i];
+		char *file = redir_name(command, r);
+		if (r->type == ELEMENT_REDIR_FD_IN || r->type == ELEMENT_REDIR_FD_OUT
+						|| r->type == ELEMENT_REDIR_CLOSE || check_expands(file)
+						|| strncmp(file, "buf:", 4) == 0) {
+			continue;
+		}
+		char buf[strlen(file) + 1];
+		check_unescape(file, buf);
+		if (r->type == ELEMENT_REDIR_FILE_IN) {
+			check_add(CHECK_INPUT, buf, line);
+		}
+		else {
+			struct check *c = check_add(CHECK_OUTPUT, buf, line);
+			if (r->type == ELEMENT_REDIR_FILE_OUT) {
+				c->created = 1;			// '>>' does not create it
+			}
+		}
+	}
+}
+
+/* Do one check, setting c->error.
+ */
+static void check_one(struct check *c){
+	switch (c->type) {
+	case CHECK_COMMAND:
+		if (strchr(c->name, '/') != 0) {
+			c->error = access(c->name, X_OK) < 0 ? errno : 0;
+		}
+		else {
+			const char *path = checkpath;
+			char file[4096];
+			c->error = ENOENT;
+			for (;;) {
+				const char *r = strchr(path, ':');
+				int len = r == 0 ? strlen(path) : r - path;
+				if (len == 0) {
+					snprintf(file, sizeof(file), "%s", c->name);
+				}
+				else {
+					snprintf(file, sizeof(file), "%.*s/%s", len, path, c->name);
+				}
+				if (access(file, X_OK) == 0) {
+					c->error = 0;
+					break;
+				}
+				if (r == 0) {
+					break;
+				}
+				path = r + 1;
+			}
+		}
+		break;
+	case CHECK_INPUT:
+		c->error = access(c->name, R_OK) < 0 ? errno : 0;
+		break;
+	case CHECK_OUTPUT:
+		if (access(c->name, F_OK) == 0) {
+			c->error = access(c->name, W_OK) < 0 ? errno : 0;
+		}
+		else {
+			char dir[strlen(c->name) + 2], *slash;
+			strcpy(dir, c->name);
+			if ((slash = strrchr(dir, '/')) == 0) {
+				strcpy(dir, ".");
+			}
+			else {
+				slash[slash == dir] = 0;		// keep the / of "/file"
+			}
+			c->error = access(dir, W_OK) < 0 ? errno : 0;
+		}
+		break;
+	}
+}
+
+static void *check_thread(void *arg){
+	unsigned int i;
+
+	while ((i = __atomic_fetch_add(&nextcheck, 1, __ATOMIC_RELAXED)) < nchecks) {
+		check_one(checks[i]);
+	}
+	return 0;
+}
+
+/* Do all the checks on a pool of threads.
+ */
+static void check_run(){
+	pthread_t threads[CHECK_THREADS];
+	long n = sysconf(_SC_NPROCESSORS_ONLN) * 2;
+	int i;
+
+	if (n > CHECK_THREADS) {
+		n = CHECK_THREADS;
+	}
+	if (n > nchecks / 64) {			// not worth a thread per few checks
+		n = nchecks / 64;
+	}
+	for (i = 0; i < n; i++) {
+		if (pthread_create(&threads[i], 0, check_thread, 0) != 0) {
+			break;
+		}
+	}
+	check_thread(0);
+	while (i-- > 0) {
+		pthread_join(threads[i], 0);
+	}
+}
+
+int check_script(int fd){
+	struct {
+		unsigned int line;
+		int inbody;
+		int begin;				// a block rather than a loop
+	} loops[64];
+	int depth = 0, errors = 0, more = 1;
+	unsigned int line = 0, i;
+	struct command command;
+
+	memset(&command, 0, sizeof(command));
+	checkpath = getenv("PATH");
+	if (checkpath == 0) {
+		checkpath = "";
+	}
+
+	reader_t reader = reader_create(fd);
+	tokenizer_t tokenizer = tokenizer_create(reader);
+	parser_t parser = parser_create(tokenizer);
+	parser_set_check(parser, 1);
+
+	while (more) {
+		struct element elt;
+
+		parser_next(parser, &elt);
+		switch (elt.type) {
+		case ELEMENT_ARG:
+			if (command.argc == 0 && command.nredirs == 0) {
+				line = parser_line(parser);
+			}
+			command_arg(&command, sstring_get(&elt.string), elt.string.len);
+			element_release(&elt);
+			continue;
+		case ELEMENT_REDIR_FILE_IN:
+		case ELEMENT_REDIR_FILE_OUT:
+		case ELEMENT_REDIR_FILE_APPEND:
+		case ELEMENT_REDIR_FD_IN:
+		case ELEMENT_REDIR_FD_OUT:
+		case ELEMENT_REDIR_CLOSE:
+			if (command.argc == 0 && command.nredirs == 0) {
+				line = parser_line(parser);
+			}
+			command_redir(&command, &elt);
+			element_release(&elt);
+			continue;
+		case ELEMENT_ERROR:
+			errors++;
+			continue;
+		case ELEMENT_EOF:
+			more = 0;
+			break;
+		default:
+			element_release(&elt);		// the group of a background command
+			break;
+		}
+
+		/* The command is complete.
+		 */
+		command_finish(&command);
+		char *keyword = command.argv[0];
+		int first = 0;
+		if (keyword == 0) {
+			/* only redirections */
+		}
+		else if (strcmp(keyword, "while") == 0 || strcmp(keyword, "begin") == 0) {
+			if (depth == 64) {
+				fprintf(stderr, "line %u: loops nested too deeply\n", line);
+				errors++;
+			}
+			else {
+				loops[depth].line = line;
+				loops[depth].begin = keyword[0] == 'b';
+				loops[depth++].inbody = keyword[0] == 'b';
+			}
+			first = 1;
+		}
+		else if (strcmp(keyword, "do") == 0) {
+			if (depth == 0 || loops[depth - 1].inbody) {
+				fprintf(stderr, "line %u: unexpected 'do'\n", line);
+				errors++;
+			}
+			else {
+				loops[depth - 1].inbody = 1;
+			}
+			first = 1;
+		}
+		else if (strcmp(keyword, "done") == 0 || strcmp(keyword, "end") == 0) {
+			if (depth == 0 || !loops[depth - 1].inbody
+							|| loops[depth - 1].begin != (keyword[0] == 'e')) {
+				fprintf(stderr, "line %u: unexpected '%s'\n", line, keyword);
+				errors++;
+			}
+			else {
+				depth--;
+			}
+			first = command.argc - 1;
+		}
+		check_command(&command, first, line);
+		command_clear(&command);
+	}
+	while (depth > 0) {
+		depth--;
+		fprintf(stderr, "line %u: missing '%s'\n", loops[depth].line,
+									loops[depth].begin ? "end" : "done");
+		errors++;
+	}
+
+	parser_free(parser);
+	tokenizer_free(tokenizer);
+	reader_free(reader);
+	command_free(&command);
+
+	check_run();
+	for (i = 0; i < nchecks; i++) {
+		struct check *c = checks[i];
+		if (c->error == 0) {
+			continue;
+		}
+		errors++;
+		switch (c->type) {
+		case CHECK_COMMAND:
+			if (c->error == ENOENT && strchr(c->name, '/') == 0) {
+				fprintf(stderr, "line %u: %s: command not found\n", c->line, c->name);
+			}
+			else {
+				fprintf(stderr, "line %u: %s: %s\n", c->line, c->name, strerror(c->error));
+			}
+			break;
+		case CHECK_INPUT:
+			fprintf(stderr, "line %u: < %s: %s\n", c->line, c->name, strerror(c->error));
+			break;
+		case CHECK_OUTPUT:
+			fprintf(stderr, "line %u: > %s: %s\n", c->line, c->name, strerror(c->error));
+			break;
+		}
+	}
+	return errors > 0;
+}
@@ -0,0 +1,170 @@
+/* Storage for commands.
+ *
+ * A command keeps its arguments and file names back to back in a string
+ * arena, and its redirections in an array of fixed-size records.  All
+ * three arrays grow by doubling and are kept when a command is cleared,
+ * so that a long script is read without any allocation per command.
+ *
+ * The interface is as follows:
+ *	void command_arg(command_t command, const char *arg, unsigned int len):
+ *		Append an argument.
+ *
+ *	void command_redir(command_t command, element_t elt):
+ *		Append the redirection in the given element.
+ *
+ *	void command_add_redir(command_t command, int type, int fd,
+ *						unsigned int fd2, const char *name, unsigned int len):
+ *		Append a redirection of the given type.  name is only used for
+ *		redirections to files, and fd2 only for redirections to fds.
+ *
+ *	void command_copy(command_t dst, command_t src, int first):
+ *		Append the arguments of src starting at argv[first], and all
+ *		of its redirections, to dst, and copy its pipes.
+ *
+ *	void command_finish(command_t command):
+ *		Terminate argv with a null pointer.
+ *
+ *	void command_clear(command_t command):
+ *		Remove all arguments and redirections, keeping the storage.
+ *
+ *	void command_free(command_t command):
+ *		Release the storage of the command.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "shall.h"
+
+/* Make room for at least 'size' more bytes in the string arena.  The
+ * arguments point into the arena, so they have to be moved along; while
+ * the arena moves they hold their offset plus one, as 0 is the end of
+ * argv.
+ */
+static void command_reserve(command_t command, unsigned int size){
+	if (command->nstrings + size <= command->maxstrings) {
+		return;
+	}
+
+	unsigned int max = command->maxstrings == 0 ? 256 : command->maxstrings;
+	while (max < command->nstrings + size) {
+		max *= 2;
+	}
+
+	int i;
+	for (i = 0; i < command->argc; i++) {
+		if (command->argv[i] != 0) {
+			command->argv[i] = (char *) (command->argv[i] - command->strings + 1);
+		}
+	}
+	command->strings = mem_realloc(MEM_COMMAND, command->strings, max);
+	command->maxstrings = max;
+	for (i = 0; i < command->argc; i++) {
+		if (command->argv[i] != 0) {
+			command->argv[i] = command->strings + (size_t) command->argv[i] - 1;
+		}
+	}
+}
+
+/* Copy a string into the arena and return its offset.  Remember if it
+ * needs to be expanded before the command is executed.
+ */
+static unsigned int command_string(command_t command, const char *s, unsigned int len){
+	unsigned int i;
+
+	command_reserve(command, len + 1);
+	unsigned int offset = command->nstrings;
+	for (i = 0; i < len; i++) {
+		if (s[i] > 0 && s[i] <= CTL_MAX) {
+			command->expand = 1;
+			break;
+		}
+	}
+	memcpy(command->strings + offset, s, len);
+	command->strings[offset + len] = 0;
+	command->nstrings += len + 1;
+	return offset;
+}
+
+static void command_argv_append(command_t command, char *arg){
+	if (command->argc == command->maxargv) {
+		command->maxargv = command->maxargv == 0 ? 16 : command->maxargv * 2;
+		command->argv = mem_realloc(MEM_COMMAND, command->argv, command->maxargv * sizeof(*command->argv));
+	}
+	command->argv[command->argc++] = arg;
+}
+
+void command_arg(command_t command, const char *arg, unsigned int len){
+	unsigned int offset = command_string(command, arg, len);
+	command_argv_append(command, command->strings + offset);
+}
+
+void command_add_redir(command_t command, int type, int fd, unsigned int fd2,
+										const char *name, unsigned int len){
+	if (command->nredirs == command->maxredirs) {
+		command->maxredirs = command->maxredirs == 0 ? 8 : command->maxredirs * 2;
+		command->redirs = mem_realloc(MEM_COMMAND, command->redirs,
+					command->maxredirs * sizeof(*command->redirs));
+	}
+
+	struct redir *r = &command->redirs[command->nredirs++];
+	r->type = type;
+	r->fd = fd;
+	switch (type) {
+	case ELEMENT_REDIR_FILE_IN:
+	case ELEMENT_REDIR_FILE_OUT:
+	case ELEMENT_REDIR_FILE_APPEND:
+		r->target = command_string(command, name, len);
+		break;
+	default:
+		r->target = fd2;
+	}
+}
+
+void command_redir(command_t command, element_t elt){
+	command_add_redir(command, elt->type, elt->fd1, elt->fd2,
+						sstring_get(&elt->string), elt->string.len);
+}
+
+void command_copy(command_t dst, command_t src, int first){
+	int i;
+
+	for (i = first; i < src->argc; i++) {
+		if (src->argv[i] != 0) {
+			command_arg(dst, src->argv[i], strlen(src->argv[i]));
+		}
+	}
+	for (i = 0; i < src->nredirs; i++) {
+		struct redir *r = &src->redirs[i];
+		switch (r->type) {
+		case ELEMENT_REDIR_FILE_IN:
+		case ELEMENT_REDIR_FILE_OUT:
+		case ELEMENT_REDIR_FILE_APPEND:
+			command_add_redir(dst, r->type, r->fd, 0,
+							redir_name(src, r), strlen(redir_name(src, r)));
+			break;
+		default:
+			command_add_redir(dst, r->type, r->fd, r->target, 0, 0);
+		}
+	}
+	dst->pipein = src->pipein;
+	dst->pipemore = src->pipemore;
+}
+
+void command_finish(command_t command){
+	command_argv_append(command, 0);
+}
+
+void command_clear(command_t command){
+	command->argc = 0;
+	command->nredirs = 0;
+	command->nstrings = 0;
+	command->expand = 0;
+	command->pipein = command->pipemore = 0;
+}
+
+void command_free(command_t command){
+	mem_free(command->argv);
+	mem_free(command->redirs);
+	mem_free(command->strings);
+	memset(command, 0, sizeof(*command));
+}
@@ -0,0 +1,343 @@
+/* Compiling a shall script into a program of its own.
+ *
+ *	shallc script -o prog
+ *
+ * parses the script with the tokenizer and parser, and writes prog: a
+ * copy of the shall with the plan of the script appended, followed by a
+ * trailer that locates it.  The plan is the binary input format of
+ * decode.c, with the arguments in the form the tokenizer produces so
+ * that expansions still happen when the plan runs, and with 'p' records
+ * first that give the file each command name was found in.  When prog
+ * starts, the shall finds the trailer in its own executable and runs the
+ * plan straight from memory: nothing is parsed, and commands that are
+ * still where they were found need no search of $PATH.  Arguments of
+ * prog become $1 through $9.
+ *
+ * shallc is the shall under another name, so 'make' links it.
+ *
+ * The interface is as follows:
+ *	int shallc(int argc, char **argv):
+ *		The main program of shallc.  Returns the exit status.
+ *
+ *	char *plan_load(unsigned int *len):
+ *		Return the plan that the executable carries, and set *len to
+ *		its length, or return 0 if it carries none.  The plan is to be
+ *		freed with mem_free().
+ */
+
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include "shall.h"
+
+#define PLAN_MAGIC		"SHALLPLN"
+#define PLAN_EXE		"/proc/self/exe"
+
+struct plan_trailer {
+	uint64_t offset, length;	// of the plan in the executable
+	char magic[8];
+};
+
+/* A plan being written: the records for the command names found, which
+ * go first, and those for the commands.
+ */
+struct plan {
+	struct planbuf {
+		char *buf;
+		unsigned int len, size;
+	} seeds, body;
+	char **names;				// command names looked up so far
+	unsigned int nnames, maxnames;
+};
+
+static void plan_append(struct planbuf *pb, const void *data, unsigned int len){
+	if (pb->len + len > pb->size) {
+		while (pb->len + len > pb->size) {
+			pb->size = pb->size == 0 ? 4096 : pb->size * 2;
+		}
+		pb->buf = mem_realloc(MEM_SHALL, pb->buf, pb->size);
+	}
+	memcpy(pb->buf + pb->len, data, len);
+	pb->len += len;
+}
+
+/* Append a record: its type, the fd if withfd is set, and a string.
+ */
+static void plan_record(struct planbuf *pb, char type, int fd, int withfd,
+									const char *s, unsigned int len){
+	uint32_t n = len + (withfd ? sizeof(int32_t) : 0);
+	int32_t v = fd;
+
+	plan_append(pb, &n, sizeof(n));
+	plan_append(pb, &type, 1);
+	if (withfd) {
+		plan_append(pb, &v, sizeof(v));
+	}
+	plan_append(pb, s, len);
+}
+
+/* Look a command name up the first time it is seen, and record the file
+ * it runs if that is an absolute path.
+ */
+static void plan_resolve(struct plan *p, const char *name, unsigned int len){
+	unsigned int i;
+	int script;
+
+	for (i = 0; i < len; i++) {
+		if (name[i] > 0 && name[i] <= CTL_MAX) {
+			return;				// known only when the plan runs
+		}
+	}
+	for (i = 0; i < p->nnames; i++) {
+		if (strcmp(p->names[i], name) == 0) {
+			return;
+		}
+	}
+	if (p->nnames == p->maxnames) {
+		p->maxnames = p->maxnames == 0 ? 16 : p->maxnames * 2;
+		p->names = mem_realloc(MEM_SHALL, p->names, p->maxnames * sizeof(*p->names));
+	}
+	p->names[p->nnames] = mem_alloc(MEM_SHALL, len + 1);
+	strcpy(p->names[p->nnames++], name);
+
+	const char *file = path_lookup(name, &script);
+	if (file != 0 && file[0] == '/' && strchr(name, '/') == 0) {
+		unsigned int flen = strlen(file);
+		char rec[len + 1 + flen + 1];
+		memcpy(rec, name, len + 1);
+		memcpy(rec + len + 1, file, flen + 1);
+		plan_record(&p->seeds, 'p', 0, 0, rec, sizeof(rec));
+	}
+}
+
+/* Parse the script into the plan.  Returns the number of errors.
+ */
+static int plan_parse(struct plan *p, reader_t reader){
+	struct planbuf *pb = &p->body;
+	tokenizer_t tokenizer = tokenizer_create(reader);
+	parser_t parser = parser_create(tokenizer);
+	int errors = 0, nargs = 0, piped = 0, more = 1;
+	static const char redirs[] = {
+		[ELEMENT_REDIR_FILE_IN] = '<',
+		[ELEMENT_REDIR_FILE_OUT] = '>',
+		[ELEMENT_REDIR_FILE_APPEND] = '+',
+	};
+
+	parser_set_check(parser, 1);
+	while (more) {
+		struct element elt;
+
+		parser_next(parser, &elt);
+		switch (elt.type) {
+		case ELEMENT_ARG:
+			if (nargs++ == 0) {
+				plan_resolve(p, sstring_get(&elt.string), elt.string.len);
+			}
+			plan_record(pb, 'w', 0, 0, sstring_get(&elt.string), elt.string.len);
+			break;
+		case ELEMENT_REDIR_FILE_IN:
+		case ELEMENT_REDIR_FILE_OUT:
+		case ELEMENT_REDIR_FILE_APPEND:
+		case ELEMENT_REDIR_FD_IN:
+		case ELEMENT_REDIR_FD_OUT:
+		case ELEMENT_REDIR_CLOSE:
+			if (elt.fd1 < 0 || ((elt.type == ELEMENT_REDIR_FD_IN
+						|| elt.type == ELEMENT_REDIR_FD_OUT) && (int) elt.fd2 < 0)) {
+				fprintf(stderr, "line %u: named file descriptors cannot be compiled\n",
+														parser_line(parser));
+				errors++;
+			}
+			else if (elt.type == ELEMENT_REDIR_CLOSE) {
+				plan_record(pb, '-', elt.fd1, 1, 0, 0);
+			}
+			else if (elt.type == ELEMENT_REDIR_FD_IN || elt.type == ELEMENT_REDIR_FD_OUT) {
+				int32_t fd2 = elt.fd2;
+				plan_record(pb, '=', elt.fd1, 1, (const char *) &fd2, sizeof(fd2));
+			}
+			else {
+				plan_record(pb, redirs[elt.type], elt.fd1, 1,
+								sstring_get(&elt.string), elt.string.len);
+			}
+			break;
+		case ELEMENT_PIPE:
+			plan_record(pb, '|', elt.fd1, 1, 0, 0);
+			nargs = 0;
+			piped = 1;
+			break;
+		case ELEMENT_EOLN:
+		case ELEMENT_SEMI:
+		case ELEMENT_BACKGROUND:
+		case ELEMENT_EOF:
+			/* A pipe at the end of a line continues on the next one.
+			 */
+			if (nargs > 0 || !piped || elt.type != ELEMENT_EOLN) {
+				plan_record(pb, elt.type == ELEMENT_BACKGROUND ? '&' : ';', 0, 0,
+								sstring_get(&elt.string), elt.string.len);
+				piped = 0;
+			}
+			nargs = 0;
+			more = elt.type != ELEMENT_EOF;
+			break;
+		case ELEMENT_ERROR:
+			errors++;
+			break;
+		default:
+			break;
+		}
+		element_release(&elt);
+	}
+	parser_free(parser);
+	tokenizer_free(tokenizer);
+	return errors;
+}
+
+/* Find the plan in the executable open on fd.  Returns -1 if there is
+ * none.
+ */
+static int plan_find(int fd, struct plan_trailer *t){
+	struct stat st;
+
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(*t)) {
+		return -1;
+	}
+	if (pread(fd, t, sizeof(*t), st.st_size - sizeof(*t)) != sizeof(*t)
+					|| memcmp(t->magic, PLAN_MAGIC, sizeof(t->magic)) != 0
+					|| t->offset + t->length + sizeof(*t) != (uint64_t) st.st_size) {
+		return -1;
+	}
+	return 0;
+}
+
+static int plan_write(int fd, const void *data, unsigned int len){
+	const char *p = data;
+
+	while (len > 0) {
+		int n = write(fd, p, len);
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Write prog: the shall without any plan it carries, then the plan and
+ * its trailer.
+ */
+static int plan_output(struct plan *p, const char *prog){
+	struct plan_trailer t;
+	char buf[65536];
+	off_t copy;
+	int in, out, n, r = 0;
+
+	if ((in = open(PLAN_EXE, O_RDONLY | O_CLOEXEC)) < 0) {
+		perror(PLAN_EXE);
+		return -1;
+	}
+	if (plan_find(in, &t) == 0) {
+		copy = t.offset;
+	}
+	else if ((copy = lseek(in, 0, SEEK_END)) < 0) {
+		perror(PLAN_EXE);
+		close(in);
+		return -1;
+	}
+	lseek(in, 0, SEEK_SET);
+	if ((out = open(prog, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0777)) < 0) {
+		perror(prog);
+		close(in);
+		return -1;
+	}
+	for (t.offset = 0; (off_t) t.offset < copy; t.offset += n) {
+		if ((n = read(in, buf, copy - t.offset < (off_t) sizeof(buf) ? copy - t.offset : sizeof(buf))) <= 0
+						|| plan_write(out, buf, n) < 0) {
+			r = -1;
+			break;
+		}
+	}
+	t.length = p->seeds.len + p->body.len;
+	memcpy(t.magic, PLAN_MAGIC, sizeof(t.magic));
+	if (r < 0 || plan_write(out, p->seeds.buf, p->seeds.len) < 0
+				|| plan_write(out, p->body.buf, p->body.len) < 0
+				|| plan_write(out, &t, sizeof(t)) < 0) {
+		perror(prog);
+		r = -1;
+	}
+	close(in);
+	if (close(out) < 0) {
+		perror(prog);
+		r = -1;
+	}
+	return r;
+}
+
+int shallc(int argc, char **argv){
+	struct plan p;
+	const char *prog = 0;
+	unsigned int i;
+	int c, errors;
+
+	while ((c = getopt(argc, argv, "o:")) != -1) {
+		switch (c) {
+		case 'o':
+			prog = optarg;
+			break;
+		default:
+			prog = 0;
+			optind = argc;
+		}
+	}
+	if (prog == 0 || optind != argc - 1) {
+		fprintf(stderr, "Usage: %s script -o prog\n", argv[0]);
+		return 2;
+	}
+
+	reader_t reader = reader_open(argv[optind]);
+	if (reader == 0) {
+		return 1;
+	}
+	memset(&p, 0, sizeof(p));
+	errors = plan_parse(&p, reader);
+	reader_free(reader);
+	if (errors > 0) {
+		fprintf(stderr, "%s: %d errors, %s not written\n", argv[0], errors, prog);
+	}
+	else if (plan_output(&p, prog) < 0) {
+		errors = 1;
+	}
+
+	for (i = 0; i < p.nnames; i++) {
+		mem_free(p.names[i]);
+	}
+	mem_free(p.names);
+	mem_free(p.seeds.buf);
+	mem_free(p.body.buf);
+	return errors > 0;
+}
+
+char *plan_load(unsigned int *len){
+	struct plan_trailer t;
+	char *plan = 0;
+	int fd = open(PLAN_EXE, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return 0;
+	}
+	if (plan_find(fd, &t) == 0) {
+		plan = mem_alloc(MEM_SHALL, t.length + 1);
+		if (pread(fd, plan, t.length, t.offset) != (ssize_t) t.length) {
+			perror(PLAN_EXE);
+			mem_free(plan);
+			plan = 0;
+		}
+		*len = t.length;
+	}
+	close(fd);
+	return plan;
+}
@@ -0,0 +1,363 @@
+/* Input formats for commands generated by programs.
+ *
+ * A program that generates commands has them as argument vectors
+ * already, and turning them into text only for the tokenizer and parser
+ * to take them apart again costs time, and quoting bugs when an argument
+ * contains something special.  With --input-format the shall reads the
+ * commands in one of these formats instead, and puts the arguments
+ * straight into the command, without any quoting, escapes or expansion.
+ *
+ *	nul:	every argument is followed by a null character, and every
+ *			command by a record separator character ('\036').
+ *
+ *	binary:	a sequence of records, each consisting of a 32-bit length,
+ *			a type character, and a payload of that length.  Numbers
+ *			are 32 bits in the byte order of the machine, as in pool.c.
+ *
+ *			'w'		an argument, the payload.
+ *			'<'		input from a file: the fd, then the file name.
+ *			'>'		output to a file: the fd, then the file name.
+ *			'+'		output appended to a file: the same.
+ *			'='		the fd, then the fd it becomes a copy of.
+ *			'-'		close the fd.
+ *			'|'		end of the command, with the fd that the next
+ *					command reads, as for '{N}|'.
+ *			';'		end of the command, with an empty payload.
+ *			'&'		end of the command, which runs in the background,
+ *					in the group named by the payload if it is not empty.
+ *			'p'		a command name, a null character, and the file
+ *					that the name runs, which the path cache takes
+ *					instead of searching $PATH.
+ *
+ *			A record of an unknown type is skipped with a complaint.
+ *
+ *	plan:	the binary format, with the arguments and file names in the
+ *			form the tokenizer produces, expansions included.  This is
+ *			what shallc writes (see compile.c); it is not an input
+ *			format of its own.
+ *
+ * The input is read in large blocks, and the arguments are copied from
+ * the block into the command.  Commands are handed to the block as in
+ * interpret(), so loop keywords still work.
+ *
+ * The interface is as follows:
+ *	int decode_format(const char *name):
+ *		Return the input format with the given name ("text", "nul"
+ *		or "binary"), or -1 if there is none.
+ *
+ *	void decode(int fd, int format):
+ *		Read commands in the given format from fd and run them.
+ *
+ *	void decode_buffer(const char *buf, unsigned int len, int format):
+ *		The same, for input that is in memory already.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include "shall.h"
+
+#define DECODE_BUFSIZE	65536
+#define DECODE_MAXLEN	(256 * 1024 * 1024)	// longest record or argument
+#define DECODE_RS		'\036'
+#define DECODE_TYPES	"w<>+=-|;&p"
+#define DECODE_FDTYPES	"<>+=-|"		// records that start with a fd
+
+struct decoder {
+	int fd;							// -1 if all input is in buf
+	int raw;						// strings are as the tokenizer makes them
+	char *buf;
+	unsigned int start, end, size;	// unused input is buf[start..end)
+	char *escaped;					// for arguments with CTL_* characters
+	unsigned int maxescaped;
+	int pipein;						// as in interpret()
+	block_t block;
+	struct command command;
+};
+
+/* Make sure that at least need bytes of input are available, reading
+ * more and growing the buffer if needed.  Returns -1 if the input ends
+ * first, or if need is more than DECODE_MAXLEN, which also keeps the
+ * size of the buffer from overflowing as it doubles; the input is then
+ * dropped.
+ */
+static int decoder_fill(struct decoder *d, unsigned int need){
+	if (d->end - d->start >= need) {
+		return 0;
+	}
+	if (d->fd < 0) {
+		return -1;
+	}
+	if (need > DECODE_MAXLEN) {
+		fprintf(stderr, "input: record too long\n");
+		d->start = d->end;			// the rest cannot be made sense of
+		return -1;
+	}
+	if (d->start > 0) {
+		memmove(d->buf, d->buf + d->start, d->end - d->start);
+		d->end -= d->start;
+		d->start = 0;
+	}
+	if (need > d->size) {
+		while (d->size < need) {
+			d->size *= 2;
+		}
+		d->buf = mem_realloc(MEM_SHALL, d->buf, d->size);
+	}
+	while (d->end < need) {
+		int n = read(d->fd, d->buf + d->end, d->size - d->end);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			perror("input");
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		d->end += n;
+	}
+	return 0;
+}
+
+/* Store a string of the input as an argument or file name.  The command
+ * must take it literally, so the characters that mark expansions are
+ * escaped, as the tokenizer does.
+ */
+static const char *decoder_literal(struct decoder *d, const char *s, unsigned int *len){
+	unsigned int i, n = 0;
+
+	for (i = 0; i < *len && !d->raw; i++) {
+		if (s[i] > 0 && s[i] <= CTL_MAX) {
+			break;
+		}
+	}
+	if (i == *len || d->raw) {
+		return s;
+	}
+	if (2 * *len > d->maxescaped) {
+		d->maxescaped = 2 * *len;
+		d->escaped = mem_realloc(MEM_SHALL, d->escaped, d->maxescaped);
+	}
+	for (i = 0; i < *len; i++) {
+		if (s[i] > 0 && s[i] <= CTL_MAX) {
+			d->escaped[n++] = CTL_ESC;
+		}
+		d->escaped[n++] = s[i];
+	}
+	*len = n;
+	return d->escaped;
+}
+
+static void decoder_arg(struct decoder *d, const char *s, unsigned int len){
+	s = decoder_literal(d, s, &len);
+	command_arg(&d->command, s, len);
+}
+
+/* The command is complete.
+ */
+static void decoder_command(struct decoder *d, int background){
+	status_flush();
+	if (d->command.argc > 0) {
+		d->command.pipein = d->pipein;
+		d->pipein = 0;
+		command_finish(&d->command);
+		block_command(d->block, &d->command, background);
+	}
+	else if (d->pipein != 0) {
+		fprintf(stderr, "missing command after '|'\n");
+		block_pipe_cancel(d->block);
+		d->pipein = 0;
+	}
+	command_clear(&d->command);
+}
+
+static void decode_nul(struct decoder *d){
+	for (;;) {
+		char *p = d->buf + d->start, *nul;
+		if (d->start < d->end && *p == DECODE_RS) {
+			d->start++;
+			decoder_command(d, 0);
+			continue;
+		}
+		if ((nul = memchr(p, 0, d->end - d->start)) == 0) {
+			if (decoder_fill(d, d->end - d->start + 1) < 0) {
+				break;
+			}
+			continue;
+		}
+		decoder_arg(d, p, nul - p);
+		d->start += nul - p + 1;
+	}
+	if (d->start < d->end) {
+		fprintf(stderr, "input: argument without a null character at the end\n");
+		command_clear(&d->command);
+	}
+}
+
+static int32_t decoder_int(const char *p){
+	int32_t v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static void decode_binary(struct decoder *d){
+	const unsigned int hdr = sizeof(uint32_t) + 1;
+	uint32_t len;
+	int32_t fd;
+
+	while (decoder_fill(d, hdr) == 0) {
+		memcpy(&len, d->buf + d->start, sizeof(len));
+		if (len > DECODE_MAXLEN - hdr) {
+			fprintf(stderr, "input: record too long\n");
+			d->start = d->end;
+			break;
+		}
+		if (decoder_fill(d, hdr + len) < 0) {
+			fprintf(stderr, "input: truncated record\n");
+			break;
+		}
+		char type = d->buf[d->start + sizeof(len)];
+		char *p = d->buf + d->start + hdr;
+		d->start += hdr + len;
+
+		if (type == 0 || strchr(DECODE_TYPES, type) == 0) {
+			fprintf(stderr, "input: unknown record type '%c'\n", type);
+			continue;
+		}
+
+		/* All but arguments and the ends of commands start with a fd.
+		 */
+		fd = 0;
+		if (strchr(DECODE_FDTYPES, type) != 0) {
+			if (len < sizeof(fd)) {
+				fprintf(stderr, "input: record '%c' too short\n", type);
+				continue;
+			}
+			fd = decoder_int(p);
+			p += sizeof(fd);
+			len -= sizeof(fd);
+			if (fd < 0 || (type == '|' && fd < 1)) {
+				fprintf(stderr, "input: bad file descriptor %d\n", fd);
+				continue;
+			}
+		}
+
+		switch (type) {
+		case 'w':
+			decoder_arg(d, p, len);
+			break;
+		case '<':
+		case '>':
+		case '+': {
+			const char *name = decoder_literal(d, p, &len);
+			command_add_redir(&d->command, type == '<' ? ELEMENT_REDIR_FILE_IN :
+					type == '>' ? ELEMENT_REDIR_FILE_OUT : ELEMENT_REDIR_FILE_APPEND,
+					fd, 0, name, len);
+			break;
+		}
+		case '=':
+			if (len < sizeof(fd) || decoder_int(p) < 0) {
+				fprintf(stderr, "input: bad record '='\n");
+				break;
+			}
+			command_add_redir(&d->command, ELEMENT_REDIR_FD_OUT, fd, decoder_int(p), 0, 0);
+			break;
+		case '-':
+			command_add_redir(&d->command, ELEMENT_REDIR_CLOSE, fd, 0, 0, 0);
+			break;
+		case '|':
+			if (d->command.argc == 0) {
+				fprintf(stderr, "missing command before '|'\n");
+				block_pipe_cancel(d->block);
+				d->pipein = 0;
+				command_clear(&d->command);
+				break;
+			}
+			d->command.pipemore = 1;
+			decoder_command(d, 0);
+			d->pipein = fd;
+			break;
+		case ';':
+			decoder_command(d, 0);
+			break;
+		case '&':
+			if (len == 0) {
+				decoder_command(d, 1);
+			}
+			else {
+				char group[len + 1];
+				memcpy(group, p, len);
+				group[len] = 0;
+				decoder_command(d, jobs_group(group));
+			}
+			break;
+		case 'p': {
+			const char *file = memchr(p, 0, len);
+			if (file == 0 || p[len - 1] != 0) {
+				fprintf(stderr, "input: bad record 'p'\n");
+				break;
+			}
+			path_seed(p, file + 1);
+			break;
+		}
+		}
+	}
+	if (d->start < d->end) {
+		fprintf(stderr, "input: truncated record\n");
+	}
+}
+
+int decode_format(const char *name){
+	if (strcmp(name, "text") == 0) {
+		return INPUT_TEXT;
+	}
+	if (strcmp(name, "nul") == 0) {
+		return INPUT_NUL;
+	}
+	if (strcmp(name, "binary") == 0) {
+		return INPUT_BINARY;
+	}
+	return -1;
+}
+
+static void decoder_run(struct decoder *d, int format){
+	d->raw = format == INPUT_PLAN;
+	d->block = block_create();
+	if (format == INPUT_NUL) {
+		decode_nul(d);
+	}
+	else {
+		decode_binary(d);
+	}
+	decoder_command(d, 0);		// a last command without an end
+
+	block_free(d->block);
+	command_free(&d->command);
+	mem_free(d->escaped);
+}
+
+void decode(int fd, int format){
+	struct decoder d;
+
+	memset(&d, 0, sizeof(d));
+	d.fd = fd;
+	d.size = DECODE_BUFSIZE;
+	d.buf = mem_alloc(MEM_SHALL, d.size);
+	decoder_run(&d, format);
+	mem_free(d.buf);
+}
+
+void decode_buffer(const char *buf, unsigned int len, int format){
+	struct decoder d;
+
+	memset(&d, 0, sizeof(d));
+	d.fd = -1;
+	d.buf = (char *) buf;
+	d.size = d.end = len;
+	decoder_run(&d, format);
+}
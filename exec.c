@@ -3,21 +3,135 @@
  * Architecture-dependent code.
  */
 
+#define _GNU_SOURCE
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <stdio.h>
+#include <dirent.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 #include <assert.h>
 #include "shall.h"
 
-/* This is a simple signal handler that prints the signal number.
+/* Exit status of the last command, for $?.
+ */
+int last_status;
+
+/* Set in the child that runs a command of a pipeline, which execs an
+ * external command itself rather than forking again.  Only for that one
+ * command: a script or sourced file that it runs forks as usual.
+ */
+static int nofork;
+
+/* The file descriptors that commands inherit are those up to userfd:
+ * the ones the shall inherited itself, and those set with 'exec N>file'.
+ * The shall's own descriptors are all close-on-exec, and a child closes
+ * every descriptor above userfd that its redirections do not ask for
+ * with one close_range(), rather than carrying them until execv().
+ */
+static int userfd = 2;
+static int keepfd;			// in a child: highest descriptor it was given
+
+/* Find the highest file descriptor that the shall inherited.
+ */
+void fds_init(){
+	DIR *dir = opendir("/proc/self/fd");
+	struct dirent *de;
+
+	if (dir == 0) {
+		return;
+	}
+	while ((de = readdir(dir)) != 0) {
+		int fd = atoi(de->d_name);
+		if (fd > userfd && fd != dirfd(dir)) {
+			userfd = fd;
+		}
+	}
+	closedir(dir);
+}
+
+/* In a child, after its redirections: close the descriptors that the
+ * command was not given, except for handle, the one path_exec() runs the
+ * command through.  Not for a shall script, which do_exec() runs in the
+ * child itself: the shall's tables (directories of 'in', buffers, named
+ * fds, pools, the status pipe, path handles) still refer to its
+ * descriptors, which are all close-on-exec anyway, and its own children
+ * close them in turn.
+ */
+static void fds_close(command_t command, int handle){
+	int i, max = userfd > keepfd ? userfd : keepfd;
+
+	for (i = 0; i < command->nredirs; i++) {
+		int fd = fdtab_lookup(command->redirs[i].fd);
+		if (fd > max && command->redirs[i].type != ELEMENT_REDIR_CLOSE) {
+			max = fd;
+		}
+	}
+	if (handle > max) {
+		if (handle > max + 1) {
+			close_range(max + 1, handle - 1, 0);
+		}
+		max = handle;
+	}
+	close_range(max + 1, ~0U, 0);
+}
+
+/* Readers used by the read builtin, by file descriptor.  A reader is
+ * kept across calls, so that a 'while read' loop reads its input in
+ * blocks rather than a character at a time.
+ */
+#define MAX_FDREADERS	64
+
+static reader_t fdreaders[MAX_FDREADERS];
+
+/* Forget the reader for the given file descriptor, for example because
+ * the descriptor is about to be redirected.  Any characters it read ahead
+ * are given back to the file first.
+ */
+static void fdreader_drop(int fd){
+	if (fd >= 0 && fd < MAX_FDREADERS && fdreaders[fd] != 0) {
+		reader_free(fdreaders[fd]);
+		fdreaders[fd] = 0;
+	}
+}
+
+/* Release the readers kept for the read builtin.
+ */
+void fdreaders_free(){
+	int fd;
+
+	for (fd = 0; fd < MAX_FDREADERS; fd++) {
+		fdreader_drop(fd);
+	}
+}
+
+/* Set when an interrupt arrives, so that loops can stop.
+ */
+static volatile sig_atomic_t interrupted;
+
+/* This is a simple signal handler that reports the signal number.
  */
 static void sighandler(int sig){
-	printf("got signal %d\n", sig);//if interrupt, sig=2, etc
+	status_signal(sig);//if interrupt, sig=2, etc
+	if (sig == SIGINT) {
+		interrupted = 1;
+	}
+}
+
+/* Return 1 if an interrupt arrived since interrupts_reset().
+ */
+int interrupts_pending(){
+	return interrupted;
+}
+
+void interrupts_reset(){
+	interrupted = 0;
 }
 
 /* Disable interrupts.
@@ -53,16 +167,17 @@ void interrupts_catch(){//
 
 /* This implements '{fd1} > {fd2}' directives.  That is, any output
  * produced by file descriptor fd1 should go to the same place as fd2,
- * or in other words, fd1 is to become a copy of fd2.  If redirection
- * fails, _exit(1) causes the process to fail before executing the command.
+ * or in other words, fd1 is to become a copy of fd2.  Returns -1 if
+ * redirection fails.
  */
-static void redir_fd(int fd1, int fd2){
+static int redir_fd(int fd1, int fd2){
 // BEGIN
-	printf("REDIRECT %d TO %d\n", fd1, fd2);	// replace this line
 	int newfd = dup2(fd2,fd1);
 	if(newfd<0){
-		_exit(1);
+		perror("redirect");
+		return -1;
 	}
+	return 0;
 // END
 }
 
@@ -71,184 +186,755 @@ static void redir_fd(int fd1, int fd2){
  * reading, writing, etc.  If the file is to be created, mode 0644//mode 0644 is the rw permission
  * is used.
  */
-static void redir_file(char *name, int fd, int flags){
+static int redir_file(char *name, int fd, int flags){
 // BEGIN
-	int newfd = open(name,flags,0644);
-	redir_fd(fd,newfd);//fd is 0(stdin),1(stdout),2(stderr)
+	int newfd = buf_open(name,flags);
+	if (newfd < 0) {
+		return -1;
+	}
+	if (newfd == fd) {			// opened close-on-exec, but it is for commands
+		return fcntl(fd, F_SETFD, 0);
+	}
+	int r = redir_fd(fd,newfd);//fd is 0(stdin),1(stdout),2(stderr)
 	close(newfd);//close should follow open
+	return r;
 // END
 }
 
+/* The open() flags for a redirection to a file.
+ */
+static int redir_flags(int type){
+	switch (type) {
+	case ELEMENT_REDIR_FILE_IN:
+		return O_RDONLY;
+	case ELEMENT_REDIR_FILE_OUT:
+		return O_WRONLY | O_CREAT | O_TRUNC;
+	default:
+		return O_WRONLY | O_APPEND;
+	}
+}
+
 /* Handle the I/O redirections in the command in the order given.
+ * Named file descriptors are those of the fd table.  Returns -1 if one
+ * of them fails.
  */
-static void redir(command_t command){
-	int i;
+static int redir(command_t command){
+	int i, r, fd;
 	for (i = 0; i < command->nredirs; i++) {
-		element_t elt = command->redirs[i];
-		switch (elt->type) {
+		struct redir *rd = &command->redirs[i];
+		if ((fd = fdtab_fd(rd->fd)) < 0) {
+			return -1;
+		}
+		switch (rd->type) {
 		case ELEMENT_REDIR_FILE_IN:
-			redir_file(elt->u.redir_file.name, elt->u.redir_file.fd, O_RDONLY);
-			break;
 		case ELEMENT_REDIR_FILE_OUT:
-			redir_file(elt->u.redir_file.name, elt->u.redir_file.fd, O_WRONLY | O_CREAT | O_TRUNC);
-			break;
 		case ELEMENT_REDIR_FILE_APPEND:
-			redir_file(elt->u.redir_file.name, elt->u.redir_file.fd, O_WRONLY | O_APPEND);
+			r = redir_file(redir_name(command, rd), fd, redir_flags(rd->type));
 			break;
 		case ELEMENT_REDIR_FD_IN:
 		case ELEMENT_REDIR_FD_OUT:
-			redir_fd(elt->u.redir_fd.fd1, elt->u.redir_fd.fd2);
+			r = fdtab_fd((int) rd->target);
+			if (r >= 0) {
+				r = redir_fd(fd, r);
+			}
+			break;
+		case ELEMENT_REDIR_CLOSE:
+			close(fd);
+			r = 0;
 			break;
 		default:
 			assert(0);
 		}
+		if (r < 0) {
+			return -1;
+		}
 	}
+	return 0;
 }
 
-/* Try to execute the given argument vector (the first of which
- * indicates the executable itself.
+/* 'exec' without a command: apply the redirections to the shall for
+ * good.  Those of named file descriptors open, duplicate or close them
+ * in the fd table.
  */
-static void do_exec(char **argv){
-	if (strchr(argv[0], '/') == 0) {
-		char *path = getenv("PATH");
-		int proglen = strlen(argv[0]);
+static int redir_shall(command_t command){
+	int i, r;
 
-		if (path == 0) {
-			path = "";
+	for (i = 0; i < command->nredirs; i++) {
+		struct redir *rd = &command->redirs[i];
+		if (rd->fd >= 0) {
+			struct command one = *command;
+			one.redirs = rd;
+			one.nredirs = 1;
+			fdreader_drop(rd->fd);
+			r = redir(&one);
+			if (r == 0 && rd->fd > userfd && rd->type != ELEMENT_REDIR_CLOSE) {
+				userfd = rd->fd;		// commands inherit it
+			}
 		}
+		else {
+			fdreader_drop(fdtab_lookup(rd->fd));
+			switch (rd->type) {
+			case ELEMENT_REDIR_FILE_IN:
+			case ELEMENT_REDIR_FILE_OUT:
+			case ELEMENT_REDIR_FILE_APPEND:
+				r = fdtab_open(rd->fd, redir_name(command, rd), redir_flags(rd->type));
+				break;
+			case ELEMENT_REDIR_FD_IN:
+			case ELEMENT_REDIR_FD_OUT:
+				r = fdtab_dup(rd->fd, (int) rd->target);
+				break;
+			default:
+				r = fdtab_close(rd->fd);
+			}
+		}
+		if (r < 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
 
-		for (;;) {
-			char *r = strchr(path, ':');
-			int len;
+/* Apply the redirections of a command to the shall itself, so that a
+ * builtin command can honor them.  The original file descriptors are
+ * saved, and should be put back with redirect_pop() even if this fails.
+ * Until then userfd covers the new descriptors, so that the commands of
+ * a block or loop with redirections get them.
+ */
+int redirect_push(command_t command, struct fdsave *save){
+	int i, j;
 
-			if (r == 0) {
-				len = strlen(path);
-			}
-			else {
-				len = r - path;
-			}
-			if (len == 0) {
-				execv(argv[0], argv);
-			}
-			else {
-				char *file = malloc(proglen + len + 2);
-				sprintf(file, "%.*s/%s", len, path, argv[0]);
-				execv(file, argv);
-				free(file);
-			}
-			if (r == 0) {
+	fflush(stdout);
+	fflush(stderr);
+	save->n = 0;
+	save->userfd = userfd;
+	save->fds = mem_calloc(MEM_EXEC, command->nredirs * sizeof(*save->fds));
+	for (i = 0; i < command->nredirs; i++) {
+		int fd = fdtab_lookup(command->redirs[i].fd);
+		if (fd < 0) {
+			continue;		// redir() complains
+		}
+		for (j = 0; j < save->n; j++) {
+			if (save->fds[j].fd == fd) {
 				break;
 			}
-			path = r + 1;
 		}
+		if (j == save->n) {
+			fdreader_drop(fd);
+			save->fds[save->n].fd = fd;
+			save->fds[save->n].copy = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+			save->n++;
+		}
+		if (fd > userfd && command->redirs[i].type != ELEMENT_REDIR_CLOSE) {
+			userfd = fd;
+		}
+	}
+	save->raised = userfd;
+	return redir(command);
+}
+
+/* Restore the file descriptors saved by redirect_push().
+ */
+void redirect_pop(struct fdsave *save){
+	int i;
+
+	fflush(stdout);
+	fflush(stderr);
+	for (i = save->n - 1; i >= 0; i--) {
+		fdreader_drop(save->fds[i].fd);
+		if (save->fds[i].copy < 0) {
+			close(save->fds[i].fd);
+		}
+		else {
+			dup2(save->fds[i].copy, save->fds[i].fd);
+			close(save->fds[i].copy);
+		}
+	}
+	if (userfd == save->raised) {		// not raised since by 'exec N>file'
+		userfd = save->userfd;
+	}
+	mem_free(save->fds);
+}
+
+/* Execute the given argument vector, where file and script are what
+ * path_lookup() returned for argv[0].  A shall script is run right here,
+ * by the shall that is already initialized, rather than through execv()
+ * and the startup of a new shall.  Does not return.
+ */
+static void do_exec(char **argv, const char *file, int script){
+	if (file == 0 && strchr(argv[0], '/') == 0) {
 		fprintf(stderr, "%s: command not found\n", argv[0]);
 		exit(1);
 	}
-	else {
-		execv(argv[0], argv);
-		perror(argv[0]);
-		_exit(1);
+	if (script) {
+		status_child();
+		var_clear();
+		last_status = 0;
+		nofork = 0;
+		exit(interpret_file(file, argv));
 	}
+	path_exec(file == 0 ? argv[0] : file, argv);
+	perror(argv[0]);
+	_exit(1);
 }
 
 /* This function can be used by spawn() to execute the command after
  * forking and redirecting I/O.
  */
-static void execute(command_t command){
-	do_exec(command->argv);
+static void execute(command_t command, const char *file, int script){
+	do_exec(command->argv, file, script);
+}
+
+/* Wait for any child to terminate and report on it.  Returns its pid,
+ * or -1 if there are no children, and sets *exit to its exit status, or
+ * 128 plus the signal number if it was killed.
+ */
+static int reap_any(int *exit){
+	for (;;) {
+		int status;
+		int endpid = wait(&status); //child pid
+		if (endpid < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if(WIFEXITED(status)){
+            status_printf("process:%d terminated with status %d\n",endpid, WEXITSTATUS(status));
+        }
+        if(WIFSIGNALED(status)){
+        	status_printf("process:%d terminated with signal %d\n",endpid,WTERMSIG(status));
+    	}
+		*exit = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+		record_reap(endpid, *exit);
+		jobs_reaped(endpid, *exit);
+		return endpid;
+	}
+}
+
+/* Wait for process pid to terminate, reporting on the background
+ * processes that terminate in the meantime.  Returns the exit status
+ * of pid, or 128 plus the signal number if it was killed.
+ */
+static int reap(int pid){
+	int status;
+
+	for (;;) {
+		int endpid = reap_any(&status);
+		if (endpid < 0) {
+			return 1;
+		}
+		if (endpid == pid) {
+			return status;
+		}
+	}
 }
 
 /* Spawn the given command.  Run in the background if argument 'background'
  * is true (non-zero).  Otherwise wait for the command to finish.  Also
  * print information about abnormally ending processes or terminated
- * processes that ran in the background.
+ * processes that ran in the background.  Returns the exit status.
  */
-static void spawn(command_t command, int background){
+static int spawn(command_t command, int background, int dirfd){
 // BEGIN
+	/* Look the command up before forking, so that the path cache
+	 * remembers it.  Flush output that a script run in the child could
+	 * otherwise write a second time.  A relative name with a '/' is
+	 * relative to dirfd if there is one, so the child resolves it.
+	 */
+	int script = 0, stubstatus;
+	const char *file = 0;
+	if (dirfd < 0 || command->argv[0][0] == '/' || strchr(command->argv[0], '/') == 0) {
+		file = path_lookup(command->argv[0], &script);
+	}
+	if (nofork) {
+		if (dirfd >= 0 && fchdir(dirfd) < 0) {
+			perror("fchdir");
+			_exit(1);
+		}
+		if (redir(command) < 0) {
+			_exit(1);
+		}
+		if (!script) {
+			fds_close(command, path_handle(file));
+		}
+		execute(command, file, script);
+	}
+	long stub = replay_command(command->argv[0], background, &stubstatus);
+	readers_sync();
+	fflush(stdout);
+	fflush(stderr);
+	limit_spawn();
 	int pid = fork();
 	if(pid < 0){
 		fprintf(stderr, "fork failed\n");
+		return 1;
 	}
 	else if (pid == 0) {
 		if(background){
 			interrupts_disable();
-			printf("process %i running in background:\n",getpid());
 		}
-		redir(command);
-		execute(command);
+		if (stub >= 0) {		// replaying a recorded session
+			usleep(stub);
+			_exit(stubstatus);
+		}
+		if (dirfd >= 0 && fchdir(dirfd) < 0) {
+			perror("fchdir");
+			_exit(1);
+		}
+		if (redir(command) < 0) {
+			_exit(1);
+		}
+		if (!script) {
+			fds_close(command, path_handle(file));
+		}
+		execute(command, file, script);
 	}
 	else {
-		if(!background){//run in foreground
-			int status;
-			int endpid = wait(&status); //child pid
-			if(WIFEXITED(status)){
-	            printf("process:%d terminated with status %d\n",endpid, WEXITSTATUS(status));
-	        }
-	        if(WIFSIGNALED(status)){
-	        	printf("process:%d terminated with signal %d\n",endpid,WTERMSIG(status));   
-	    	}
+		record_spawn(pid, command->argv[0]);
+		if(background){
+			jobs_add(pid, background);
+			status_printf("process %i running in background:\n",pid);
+		}
+		else{//run in foreground
+			return reap(pid);
 		}
 	}
+	return 0;
+// END
+}
+
+/* Directories of 'in DIR command', kept open so that the next command
+ * in the same directory costs a stat() rather than opening it again.  An
+ * entry is used as long as the name still refers to the same directory.
+ * 'cd' drops them all, as the names may be relative.
+ */
+#define MAX_INDIRS	16
+
+static struct indir {
+	char *name;
+	int fd;					// O_PATH descriptor of the directory
+	dev_t dev;
+	ino_t ino;
+} indirs[MAX_INDIRS];
+static int nindirs, nextindir;
+
+static void indirs_flush(){
+	while (nindirs > 0) {
+		struct indir *d = &indirs[--nindirs];
+		mem_free(d->name);
+		close(d->fd);
+	}
+	nextindir = 0;
+}
+
+/* Return a descriptor for the directory, or -1 after complaining.
+ */
+static int indir_open(const char *name){
+	struct stat st;
+	struct indir *d;
+	int i, fd;
+
+	if (stat(name, &st) < 0) {
+		perror(name);
+		return -1;
+	}
+	for (i = 0; i < nindirs; i++) {
+		d = &indirs[i];
+		if (strcmp(d->name, name) == 0) {
+			if (d->dev == st.st_dev && d->ino == st.st_ino) {
+				return d->fd;
+			}
+			break;
+		}
+	}
+	if ((fd = open(name, O_PATH | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		perror(name);
+		return -1;
+	}
+	if (i == nindirs) {			// not there: take a free or the oldest entry
+		if (nindirs < MAX_INDIRS) {
+			i = nindirs++;
+		}
+		else {
+			i = nextindir;
+			nextindir = (nextindir + 1) % MAX_INDIRS;
+		}
+		d = &indirs[i];
+		if (d->name != 0) {
+			mem_free(d->name);
+			close(d->fd);
+		}
+		d->name = mem_alloc(MEM_EXEC, strlen(name) + 1);
+		strcpy(d->name, name);
+	}
+	else {
+		close(d->fd);
+	}
+	d->fd = fd;
+	d->dev = st.st_dev;
+	d->ino = st.st_ino;
+	return fd;
+}
+
+/* 'in dir command ...': run an external command in the given directory,
+ * without changing that of the shall.
+ */
+static int in(command_t command, int background){
+	if (command->argc < 4) {
+		fprintf(stderr, "Usage: in directory command [argument ...]\n");
+		return 2;
+	}
+	int dirfd = indir_open(command->argv[1]);
+	if (dirfd < 0) {
+		return 1;
+	}
+	struct command sub = *command;
+	sub.argv += 2;
+	sub.argc -= 2;
+	return spawn(&sub, background, dirfd);
 }
 
 /* Change the current working directory to command->argv[1], or to
  * the directory in environment variable $HOME if command->argv[1] = null.
  */
-static void cd(command_t command){
+static int cd(command_t command){
 	if (command->argc > 3) {
 		fprintf(stderr, "Usage: cd [directory]\n");
-		return;
+		return 1;
 	}
 	
 // BEGIN
 	char *dir = command->argv[1];
 	if(dir==0){
-		chdir(getenv("HOME"));
+		dir = getenv("HOME");
 	}
-	else{
-		int success = chdir(dir);
-		if(success==-1){
-			fprintf(stderr, "No such file or directory\n");
-		}
+	int success = chdir(dir);
+	if(success==-1){
+		fprintf(stderr, "No such file or directory\n");
+		return 1;
+	}
+	indirs_flush();
+	return 0;
+// END
+}
+
+/* Read commands from the given file.  Returns the status of the last
+ * command, or -1 if the file cannot be opened.
+ */
+static int source_file(const char *file){
+// BEGIN
+	reader_t reader = reader_open(file);
+	if (reader == 0) {
+		return -1;
 	}
+	nofork = 0;
+	interpret(reader, 0);
+	reader_free(reader);
+	return last_status;
 // END
 }
 
+/* Copy the output collected in fd to standard output, and close fd.
+ */
+static void source_output(int fd){
+	char buf[65536];
+	int n;
+
+	lseek(fd, 0, SEEK_SET);
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		if (write(1, buf, n) != n) {
+			break;
+		}
+	}
+	close(fd);
+}
+
+/* 'source -p N [-o] file...': read the files concurrently, each in a
+ * forked copy of the shall, with at most N running at a time.  With -o
+ * the output (standard output and standard error) of each file is
+ * collected in a memory file and printed in the order of the arguments,
+ * as soon as the files before it are done.  Returns the status of the
+ * first file, in argument order, that failed, or 0.
+ */
+static int source_parallel(char **files, int max, int collect){
+	int n, i, started = 0, running = 0, printed = 0, status = 0;
+
+	for (n = 0; files[n] != 0; n++)
+		;
+	struct {
+		int pid, out, done, status;
+	} *slots = mem_calloc(MEM_EXEC, n * sizeof(*slots));
+
+	readers_sync();
+	fflush(stdout);
+	fflush(stderr);
+	while (printed < n) {
+		/* Start files while there is room.
+		 */
+		while (started < n && running < max) {
+			int out = -1;
+			if (collect && (out = memfd_create(files[started], MFD_CLOEXEC)) < 0) {
+				perror("memfd_create");
+			}
+			limit_spawn();
+			int pid = fork();
+			if (pid < 0) {
+				fprintf(stderr, "fork failed\n");
+				if (out >= 0) {
+					close(out);
+				}
+				break;
+			}
+			if (pid == 0) {
+				if (out >= 0) {
+					dup2(out, 1);
+					dup2(out, 2);
+				}
+				int st = source_file(files[started]);
+				exit(st < 0 ? 1 : st);
+			}
+			slots[started].pid = pid;
+			slots[started].out = out;
+			started++;
+			running++;
+		}
+		if (running == 0 && started < n) {
+			slots[started].done = 1;		// could not fork
+			slots[started].status = 1;
+			slots[started].out = -1;
+			started++;
+		}
+		else if (running > 0) {
+			int st, pid = reap_any(&st);
+			if (pid < 0) {
+				break;
+			}
+			for (i = 0; i < started; i++) {
+				if (slots[i].pid == pid && !slots[i].done) {
+					slots[i].done = 1;
+					slots[i].status = st;
+					running--;
+					break;
+				}
+			}
+		}
+
+		/* Print the collected output of the files that are done, in order.
+		 */
+		fflush(stdout);
+		for (; printed < started && slots[printed].done; printed++) {
+			if (slots[printed].out >= 0) {
+				source_output(slots[printed].out);
+			}
+			if (status == 0) {
+				status = slots[printed].status;
+			}
+		}
+	}
+	mem_free(slots);
+	return status;
+}
+
 /* Read commands from the specified files in the list of arguments.
  * of the command.
  */
-static void source(command_t command){
+static int source(command_t command){
 	int i;
+
+	if (command->argv[1] != 0 && strcmp(command->argv[1], "-p") == 0) {
+		int max = command->argv[2] == 0 ? 0 : atoi(command->argv[2]);
+		int collect = max > 0 && command->argv[3] != 0
+								&& strcmp(command->argv[3], "-o") == 0;
+		if (max <= 0) {
+			fprintf(stderr, "Usage: source -p N [-o] file ...\n");
+			return 2;
+		}
+		return source_parallel(&command->argv[3 + collect], max, collect);
+	}
 	for (i = 1; command->argv[i] != 0; i++) {
-		char *file = command->argv[i];
-// BEGIN
-		int fd = open(file,O_RDONLY);
-		reader_t reader = reader_create(fd);
-		interpret(reader, 0);
-		reader_free(reader);
-		close(fd);
-// END
+		if (source_file(command->argv[i]) < 0) {
+			return 1;
+		}
 	}
+	return last_status;
 }
 
 /* Exit the shall.
  */
-static void do_exit(command_t command){
+static int do_exit(command_t command){
 	if (command->argc > 3) {
 		fprintf(stderr, "Usage: exit [status]\n");
-		return;
+		return 1;
 	}
 	char *status = command->argv[1];
 	exit(status == 0 ? 0 : atoi(status));
 }
 
+/* 'wait' waits for all background jobs, 'wait -n' for the next one to
+ * terminate, and 'wait group NAME' for those of a group (see jobs.c).
+ * Returns the exit status of the job for 'wait -n', and of the first job
+ * of the group that failed for 'wait group', or 127 if there is nothing
+ * to wait for.
+ */
+static int do_wait(command_t command){
+	int group, status;
+
+	if (command->argc == 2) {
+		while (jobs_running(1) > 0 && reap_any(&status) >= 0)
+			;
+		jobs_forget();
+		return 0;
+	}
+	if (command->argc == 3 && strcmp(command->argv[1], "-n") == 0) {
+		while (jobs_next(&status) < 0) {
+			if (jobs_running(1) == 0 || reap_any(&status) < 0) {
+				return 127;
+			}
+		}
+		return status;
+	}
+	if (command->argc == 4 && strcmp(command->argv[1], "group") == 0) {
+		if ((group = jobs_find(command->argv[2])) < 0) {
+			fprintf(stderr, "wait: %s: no such group\n", command->argv[2]);
+			return 127;
+		}
+		while (jobs_running(group) > 0 && reap_any(&status) >= 0)
+			;
+		return jobs_status(group);
+	}
+	fprintf(stderr, "Usage: wait [-n | group NAME]\n");
+	return 2;
+}
+
 /* Exec the given command, replacing the shall with it.
  */
-static void exec(command_t command){
-	redir(command);
-	if (command->argc > 2) {
-		do_exec(&command->argv[1]);
+static int exec(command_t command){
+	if (command->argc <= 2) {
+		return redir_shall(command) < 0;
+	}
+	if (redir(command) < 0) {
+		return 1;
+	}
+	{
+		int script = 0;
+		const char *file = path_lookup(command->argv[1], &script);
+		readers_sync();
+		do_exec(&command->argv[1], file, script);
+	}
+	return 0;
+}
+
+/* Read a line from standard input, or from the fd given with -u, and
+ * assign its fields to the named variables (or REPLY).  The last variable
+ * gets the rest of the line.  Backslashes are not special, as with -r.
+ * Returns 1 on EOF.
+ */
+static int do_read(command_t command){
+	static char *line;
+	static unsigned int max;
+	unsigned int len = 0;
+	int fd = 0, i = 1;
+	char c;
+
+	for (; command->argv[i] != 0 && command->argv[i][0] == '-'; i++) {
+		if (strcmp(command->argv[i], "-u") == 0 && command->argv[i + 1] != 0) {
+			fd = atoi(command->argv[++i]);
+		}
+		else if (strcmp(command->argv[i], "-r") != 0) {
+			fprintf(stderr, "Usage: read [-r] [-u fd] [name ...]\n");
+			return 2;
+		}
+	}
+	if (fd < 0 || fd >= MAX_FDREADERS) {
+		fprintf(stderr, "read: bad file descriptor %d\n", fd);
+		return 2;
+	}
+	if (fdreaders[fd] == 0) {
+		fdreaders[fd] = reader_create(fd);
+	}
+
+	while ((c = reader_next(fdreaders[fd])) != EOF && c != '\n') {
+		if (len + 1 >= max) {
+			max = max == 0 ? 256 : max * 2;
+			line = mem_realloc(MEM_EXEC, line, max);
+		}
+		line[len++] = c;
+	}
+	if (c == EOF && len == 0) {
+		return 1;
+	}
+	if (line == 0) {
+		line = mem_alloc(MEM_EXEC, max = 256);
+	}
+	line[len] = 0;
+
+	if (command->argv[i] == 0) {
+		var_set("REPLY", line);
+		return c == EOF;
+	}
+
+	char *p = line;
+	for (; command->argv[i] != 0; i++) {
+		char *name = command->argv[i], *end, save;
+
+		if (!var_name(name, strlen(name))) {
+			fprintf(stderr, "read: %s: not a valid name\n", name);
+			return 2;
+		}
+		while (*p == ' ' || *p == '\t') {
+			p++;
+		}
+		if (command->argv[i + 1] == 0) {
+			end = p + strlen(p);
+			while (end > p && (end[-1] == ' ' || end[-1] == '\t')) {
+				end--;
+			}
+		}
+		else {
+			for (end = p; *end != 0 && *end != ' ' && *end != '\t'; end++)
+				;
+		}
+		save = *end;
+		*end = 0;
+		var_set(name, p);
+		*end = save;
+		p = end;
 	}
+	return c == EOF;
+}
+
+/* Evaluate each argument as an arithmetic expression.  The status is 0
+ * if the value of the last one is not zero, as in 'while let "i < 10"'.
+ */
+static int let(command_t command){
+	long long n = 0;
+	int i;
+
+	if (command->argv[1] == 0) {
+		fprintf(stderr, "Usage: let expression ...\n");
+		return 2;
+	}
+	for (i = 1; command->argv[i] != 0; i++) {
+		if (arith_eval(command->argv[i], &n) < 0) {
+			return 2;
+		}
+	}
+	return n == 0;
+}
+
+/* If the command is a lone NAME=value, set the variable and return 1.
+ */
+static int assignment(command_t command){
+	char *eq = strchr(command->argv[0], '=');
+
+	if (command->argc != 2 || eq == 0 || command->nredirs > 0
+			|| !var_name(command->argv[0], eq - command->argv[0])) {
+		return 0;
+	}
+	*eq = 0;
+	var_set(command->argv[0], eq + 1);
+	*eq = '=';
+	return 1;
 }
 
 /* Builtin commands cannot run in background and I/O cannot be redirected.
@@ -265,33 +951,236 @@ static int builtin_check(command_t command, int background){
 	return 1;
 }
 
-/* Perform the command in the arguments list.
+/* Run a builtin that honors I/O redirection.  The redirections are
+ * applied to the shall for the duration of the builtin.
  */
-void perform(command_t command, int background){
-	if (strcmp(command->argv[0], "cd") == 0) {
-		if (builtin_check(command, background)) {
-			cd(command);
+static int builtin_redirect(command_t command, int (*builtin)(command_t)){
+	struct fdsave save;
+	int status = 1;
+
+	if (redirect_push(command, &save) == 0) {
+		status = (*builtin)(command);
+	}
+	redirect_pop(&save);
+	return status;
+}
+
+/* Move a pipe end above the file descriptors that the pipeline
+ * connects, so that connecting them cannot overwrite it.
+ */
+static int pipe_high(int fd, int maxfd){
+	if (fd > maxfd) {
+		return fd;
+	}
+	int high = fcntl(fd, F_DUPFD_CLOEXEC, maxfd + 1);
+	close(fd);
+	return high;
+}
+
+/* Perform a pipeline of n commands, each in a child of its own.  The
+ * first command is the main one.  A command after '|' reads the
+ * standard output of the main command and becomes the main command
+ * itself; a command after '{N}|' for N other than 1 reads fd N of the
+ * main command, which stays the main command.  So 'a {2}| b | c' pipes
+ * the standard error of a into b and its standard output into c.  The
+ * pipes are connected before the redirections of the commands are
+ * applied.  Returns the exit status of the last command.
+ */
+int perform_pipeline(command_t *stages, int n, int background){
+	int source[n], pids[n], fds[n][2];
+	int i, j, main = 0, maxfd = 1, started, status = 0, stubstatus[n];
+	long stub[n];
+
+	for (i = 0; i < n; i++) {
+		source[i] = main;
+		if (i > 0 && stages[i]->pipein == 1) {
+			main = i;
+		}
+		if (stages[i]->pipein > maxfd) {
+			maxfd = stages[i]->pipein;
+		}
+	}
+
+	/* Create the pipes, and look the commands up before forking so that
+	 * the path cache remembers them.
+	 */
+	for (i = 1; i < n; i++) {
+		if (pipe2(fds[i], O_CLOEXEC) < 0) {
+			perror("pipe");
+			while (--i > 0) {
+				close(fds[i][0]);
+				close(fds[i][1]);
+			}
+			return last_status = 1;
+		}
+		fds[i][0] = pipe_high(fds[i][0], maxfd);
+		fds[i][1] = pipe_high(fds[i][1], maxfd);
+	}
+	for (i = 0; i < n; i++) {
+		int script;
+		path_lookup(stages[i]->argv[0], &script);
+		buf_prepare(stages[i]);
+		stub[i] = replay_command(stages[i]->argv[0], background, &stubstatus[i]);
+	}
+
+	readers_sync();
+	fflush(stdout);
+	fflush(stderr);
+	for (started = 0; started < n; started++) {
+		limit_spawn();
+		int pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "fork failed\n");
+			status = 1;
+			break;
 		}
+		if (pid == 0) {
+			if (background) {
+				interrupts_disable();
+			}
+			if (started > 0) {
+				dup2(fds[started][0], 0);
+			}
+			for (j = started + 1; j < n; j++) {
+				if (source[j] == started) {
+					dup2(fds[j][1], stages[j]->pipein);
+					if (stages[j]->pipein > keepfd) {
+						keepfd = stages[j]->pipein;
+					}
+				}
+			}
+			for (j = 1; j < n; j++) {
+				close(fds[j][0]);
+				close(fds[j][1]);
+			}
+			if (stub[started] >= 0) {		// replaying a recorded session
+				usleep(stub[started]);
+				_exit(stubstatus[started]);
+			}
+			nofork = 1;
+			exit(perform(stages[started], 0));
+		}
+		pids[started] = pid;
+		record_spawn(pid, stages[started]->argv[0]);
+	}
+	for (i = 1; i < n; i++) {
+		close(fds[i][0]);
+		close(fds[i][1]);
 	}
-	else if (strcmp(command->argv[0], "source") == 0) {
-		if (builtin_check(command, background)) {
-			source(command);
+
+	if (background && started == n) {
+		for (i = 0; i < n; i++) {
+			jobs_add(pids[i], background);
+			status_printf("process %i running in background:\n", pids[i]);
 		}
+		return last_status = 0;
 	}
-	else if (strcmp(command->argv[0], "exit") == 0) {
-		if (builtin_check(command, background)) {
-			do_exit(command);
+
+	/* Wait for all of them, reporting on background processes that
+	 * terminate in the meantime.
+	 */
+	int running = started;
+	while (running > 0) {
+		int st, pid = reap_any(&st);
+		if (pid < 0) {
+			break;
+		}
+		for (i = 0; i < started; i++) {
+			if (pids[i] == pid) {
+				running--;
+				if (i == n - 1) {
+					status = st;
+				}
+				break;
+			}
 		}
 	}
-	else if (strcmp(command->argv[0], "exec") == 0) {
-		if (background) {
-			fprintf(stderr, "can't exec in background\n");
+	return last_status = status;
+}
+
+/* The builtin commands.  BUILTIN_PLAIN ones cannot be redirected, and
+ * BUILTIN_REDIRECT ones have their redirections applied to the shall
+ * while they run; neither can run in the background.  BUILTIN_ANY ones
+ * get the background argument and deal with both themselves.
+ */
+static int colon(command_t command, int background){
+	return 0;
+}
+
+static int exec_builtin(command_t command, int background){
+	if (background) {
+		fprintf(stderr, "can't exec in background\n");
+		return 1;
+	}
+	return exec(command);
+}
+
+static const struct builtin {
+	const char *name;
+	enum { BUILTIN_PLAIN, BUILTIN_REDIRECT, BUILTIN_ANY } type;
+	int (*run)(command_t command);
+	int (*run_any)(command_t command, int background);
+} builtins[] = {
+	{ ":",			BUILTIN_ANY,		0,			colon },
+	{ "@pool",		BUILTIN_ANY,		0,			pool_run },
+	{ "pool",		BUILTIN_REDIRECT,	pool,		0 },
+	{ "in",			BUILTIN_ANY,		0,			in },
+	{ "cd",			BUILTIN_PLAIN,		cd,			0 },
+	{ "source",		BUILTIN_PLAIN,		source,		0 },
+	{ "exit",		BUILTIN_PLAIN,		do_exit,	0 },
+	{ "exec",		BUILTIN_ANY,		0,			exec_builtin },
+	{ "read",		BUILTIN_REDIRECT,	do_read,	0 },
+	{ "memstat",	BUILTIN_REDIRECT,	memstat,	0 },
+	{ "spawnlimit",	BUILTIN_REDIRECT,	spawnlimit,	0 },
+	{ "buffree",	BUILTIN_REDIRECT,	buffree,	0 },
+	{ "let",		BUILTIN_PLAIN,		let,		0 },
+	{ "wait",		BUILTIN_PLAIN,		do_wait,	0 },
+	{ 0 }
+};
+
+int builtin_find(const char *name){
+	int i;
+
+	for (i = 0; builtins[i].name != 0; i++) {
+		if (strcmp(builtins[i].name, name) == 0) {
+			return i;
 		}
-		else {
-			exec(command);
+	}
+	return -1;
+}
+
+/* Perform the command in the arguments list.  Returns its exit status,
+ * which is also kept in last_status.
+ */
+int perform(command_t command, int background){
+	const struct builtin *b;
+	int status = 1, i;
+
+	buf_prepare(command);
+	if (!background && assignment(command)) {
+		status = 0;
+	}
+	else if ((i = builtin_find(command->argv[0])) >= 0) {
+		b = &builtins[i];
+		if (b->type == BUILTIN_ANY) {
+			status = (*b->run_any)(command, background);
 		}
+		else if (background) {
+			fprintf(stderr, "can't run builtin commands in background\n");
+		}
+		else if (b->type == BUILTIN_REDIRECT) {
+			status = builtin_redirect(command, b->run);
+		}
+		else if (builtin_check(command, background)) {
+			status = (*b->run)(command);
+		}
+	}
+	else if (!background && textutil_check(command)) {
+		status = builtin_redirect(command, textutil_run);
 	}
 	else {
-		spawn(command, background);
+		status = spawn(command, background, -1);
 	}
+	last_status = status;
+	return status;
 }
@@ -0,0 +1,469 @@
+/* Expansion of variables in commands.
+ *
+ * The tokenizer leaves markers (the CTL_* characters in shall.h) in the
+ * strings of a command.  Just before the command is executed, expand()
+ * builds a copy of the command with the markers replaced.  The result
+ * goes into the string arena of the copy, so expansion does not allocate
+ * once the arena has grown large enough.
+ *
+ * There is no word splitting: an argument stays one argument whatever
+ * its variables contain.  The string operations of ${...} are done here
+ * as well, on the value in the variable store, so that trimming a suffix
+ * or taking a substring does not need sed, cut or basename.
+ *
+ * The interface is as follows:
+ *	int expand(command_t out, command_t in):
+ *		Replace the contents of out with the expansion of in.  Returns
+ *		-1 if an arithmetic expression or ${...} is not valid.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <fnmatch.h>
+#include "shall.h"
+
+/* Scratch buffer for the string being expanded.
+ */
+static char *ebuf;
+static unsigned int elen, emax;
+
+static void ebuf_grow(unsigned int len){
+	if (elen + len > emax) {
+		while (elen + len > emax) {
+			emax = emax == 0 ? 256 : emax * 2;
+		}
+		ebuf = mem_realloc(MEM_EXPAND, ebuf, emax);
+	}
+}
+
+static void ebuf_append(const char *s, unsigned int len){
+	ebuf_grow(len);
+	memcpy(ebuf + elen, s, len);
+	elen += len;
+}
+
+/* Append len bytes found at offset off in the buffer itself.  Growing
+ * the buffer may move it, so the source is located afterwards.
+ */
+static void ebuf_copy(unsigned int off, unsigned int len){
+	ebuf_grow(len);
+	memcpy(ebuf + elen, ebuf + off, len);
+	elen += len;
+}
+
+/* Return the value of the variable with the given name, or 0.  num
+ * receives the values of $? and $$.
+ */
+static char *expand_value(const char *name, unsigned int len, char num[32]){
+	if (len == 1 && name[0] == '?') {
+		snprintf(num, 32, "%d", last_status);
+		return num;
+	}
+	if (len == 1 && name[0] == '$') {
+		snprintf(num, 32, "%d", (int) getpid());
+		return num;
+	}
+	return var_get(name, len);
+}
+
+/* Append the value of the variable with the given name.
+ */
+static void expand_var(const char *name, unsigned int len){
+	char num[32];
+	char *value = expand_value(name, len, num);
+
+	if (value != 0) {
+		ebuf_append(value, strlen(value));
+	}
+}
+
+/* Evaluate the arithmetic expression from s up to CTL_END, and append
+ * its value.  Returns a pointer to the CTL_END, or 0 if the expression
+ * is not valid.
+ */
+static const char *expand_arith(const char *s){
+	const char *end = strchr(s, CTL_END);
+	char expr[end - s + 1], num[32];
+	unsigned int len = 0;
+	long long n;
+
+	for (; s < end; s++) {
+		if (*s == CTL_ESC) {
+			s++;
+		}
+		expr[len++] = *s;
+	}
+	expr[len] = 0;
+	if (arith_eval(expr, &n) < 0) {
+		return 0;
+	}
+	ebuf_append(num, snprintf(num, sizeof(num), "%lld", n));
+	return end;
+}
+
+/* Return the CTL_END that closes the expansion whose text starts at s.
+ */
+static const char *expand_end(const char *s){
+	int depth = 0;
+
+	for (;; s++) {
+		switch (*s) {
+		case CTL_ESC:
+			s++;
+			break;
+		case CTL_VAR: case CTL_ARITH: case CTL_PARAM:
+			depth++;
+			break;
+		case CTL_END:
+			if (depth-- == 0) {
+				return s;
+			}
+		}
+	}
+}
+
+/* Return the first c in s up to end that is not escaped or inside a
+ * nested expansion, or end.
+ */
+static const char *expand_find(const char *s, const char *end, char c){
+	for (; s < end && *s != c; s++) {
+		if (*s == CTL_ESC) {
+			s++;
+		}
+		else if (*s == CTL_VAR || *s == CTL_ARITH || *s == CTL_PARAM) {
+			s = expand_end(s + 1);
+		}
+	}
+	return s;
+}
+
+static int expand_region(const char *s, const char *end, int pattern);
+
+/* Expand the text from s to end, followed by a null character, and return
+ * its offset in the scratch buffer.  Returns -1 on error.
+ */
+static int expand_operand(const char *s, const char *end, int pattern){
+	unsigned int start = elen;
+
+	if (expand_region(s, end, pattern) < 0) {
+		return -1;
+	}
+	ebuf_append("", 1);
+	return start;
+}
+
+/* Evaluate the expression in the scratch buffer at offset 'expr'.
+ */
+static int expand_number(int expr, long long *n){
+	return arith_eval(ebuf + expr, n);
+}
+
+/* Return 1 if the pattern at offset pat in the scratch buffer matches the
+ * len characters at offset str.  A pattern without special characters is
+ * compared directly.
+ */
+static int expand_match(unsigned int pat, unsigned int patlen, int literal,
+											unsigned int str, unsigned int len){
+	if (literal) {
+		return patlen == len && memcmp(ebuf + pat, ebuf + str, len) == 0;
+	}
+	char save = ebuf[str + len];
+	ebuf[str + len] = 0;
+	int match = fnmatch(ebuf + pat, ebuf + str, 0) == 0;
+	ebuf[str + len] = save;
+	return match;
+}
+
+/* Expand ${...}, whose text runs from s to end: ${NAME}, ${#NAME} for its
+ * length, ${NAME#pattern} and ${NAME##pattern} to remove the shortest or
+ * longest matching prefix, ${NAME%pattern} and ${NAME%%pattern} for a
+ * suffix, ${NAME/pattern/string} and ${NAME//pattern/string} to replace
+ * the first or every match, and ${NAME:offset:length} for a substring.
+ * ${NAME:-word} and the like look like a substring with a negative
+ * offset, but are the default values of sh, which are not supported, so
+ * they are reported rather than taken as a substring.
+ *
+ * The operands are expanded into the scratch buffer after the text
+ * expanded so far, the value is copied behind them, and the result is
+ * built behind that and then moved down, so no memory is allocated once
+ * the buffer has grown.
+ */
+static int expand_param(const char *s, const char *end){
+	unsigned int mark = elen, namelen;
+	const char *name, *p = s;
+	int length = 0, pat = 0, rep = 0, off = 0, len = -1, op = 0;
+	char num[32];
+
+	if (*p == '#' && p + 1 < end) {
+		length = 1;
+		p++;
+	}
+	name = p;
+	if (isalpha((unsigned char) *p) || *p == '_') {
+		while (p < end && (isalnum((unsigned char) *p) || *p == '_')) {
+			p++;
+		}
+	}
+	else if (isdigit((unsigned char) *p) || *p == '?' || *p == '$') {
+		p++;
+	}
+	namelen = p - name;
+	if (namelen == 0 || (length && p != end)) {
+		fprintf(stderr, "bad substitution\n");
+		return -1;
+	}
+
+	/* Expand the operands first, as they may assign to the variable.
+	 */
+	if (p < end) {
+		int all = p + 1 < end && p[1] == p[0];
+		const char *sep;
+		op = *p++;
+		switch (op) {
+		case '#': case '%':
+			p += all;
+			op = all ? op + 128 : op;
+			pat = expand_operand(p, end, 1);
+			break;
+		case '/':
+			p += all;
+			op = all ? op + 128 : op;
+			sep = expand_find(p, end, '/');
+			pat = expand_operand(p, sep, 1);
+			if (pat >= 0) {
+				rep = expand_operand(sep < end ? sep + 1 : end, end, 0);
+			}
+			break;
+		case ':':
+			if (p < end && strchr("-=+?", *p) != 0) {
+				fprintf(stderr, "bad substitution: ':%c' is not supported\n", *p);
+				return -1;		// not an offset: write ${NAME: -1} for that
+			}
+			sep = expand_find(p, end, ':');
+			off = expand_operand(p, sep, 0);
+			if (sep < end && off >= 0 && (len = expand_operand(sep + 1, end, 0)) < 0) {
+				return -1;
+			}
+			break;
+		default:
+			fprintf(stderr, "bad substitution\n");
+			return -1;
+		}
+		if (pat < 0 || rep < 0 || off < 0) {
+			return -1;
+		}
+	}
+
+	char *value = expand_value(name, namelen, num);
+	unsigned int vlen = value == 0 ? 0 : strlen(value);
+	unsigned int start = 0, n = vlen;		// the result, if a substring
+
+	if (length) {
+		elen = mark;
+		ebuf_append(num, snprintf(num, sizeof(num), "%u", vlen));
+		return 0;
+	}
+	if (op == 0) {
+		ebuf_append(value, vlen);
+		return 0;
+	}
+	if (op == ':') {
+		long long o, l = vlen;
+		if (expand_number(off, &o) < 0 || (len > 0 && expand_number(len, &l) < 0)) {
+			return -1;
+		}
+		if (o < 0) {
+			o = o + vlen < 0 ? vlen : o + vlen;
+		}
+		if (o > vlen) {
+			o = vlen;
+		}
+		if (l < 0) {
+			l = l + vlen < o ? 0 : l + vlen - o;
+		}
+		if (l > vlen - o) {
+			l = vlen - o;
+		}
+		elen = mark;
+		ebuf_append(value + o, l);
+		return 0;
+	}
+
+	/* Pattern operations.  Copy the value behind the operands, so that it
+	 * can be cut into null-terminated pieces for fnmatch().
+	 */
+	unsigned int patlen = strlen(ebuf + pat);
+	int literal = strpbrk(ebuf + pat, "*?[\\") == 0;
+	unsigned int v = elen, i, j;
+	ebuf_append(value, vlen);
+	ebuf_append("", 1);
+
+	switch (op) {
+	case '#':
+		for (i = 0; i <= vlen; i++) {
+			if (expand_match(pat, patlen, literal, v, i)) {
+				start = i;
+				n = vlen - i;
+				break;
+			}
+		}
+		break;
+	case '#' + 128:
+		for (i = vlen + 1; i-- > 0; ) {
+			if (expand_match(pat, patlen, literal, v, i)) {
+				start = i;
+				n = vlen - i;
+				break;
+			}
+		}
+		break;
+	case '%':
+		for (i = vlen + 1; i-- > 0; ) {
+			if (expand_match(pat, patlen, literal, v + i, vlen - i)) {
+				n = i;
+				break;
+			}
+		}
+		break;
+	case '%' + 128:
+		for (i = 0; i <= vlen; i++) {
+			if (expand_match(pat, patlen, literal, v + i, vlen - i)) {
+				n = i;
+				break;
+			}
+		}
+		break;
+	default:
+		/* Replacement: build the result behind the value, then move it
+		 * down to where the expansion belongs.
+		 */
+		{
+			unsigned int r = elen, replen = strlen(ebuf + rep), done = 0;
+			for (i = 0; i < vlen; ) {
+				unsigned int m = 0;
+				if (!done && patlen > 0) {
+					if (literal) {
+						m = vlen - i >= patlen && memcmp(ebuf + v + i, ebuf + pat, patlen) == 0
+									? patlen : 0;
+					}
+					else {
+						for (j = vlen - i; j > 0; j--) {
+							if (expand_match(pat, patlen, 0, v + i, j)) {
+								m = j;
+								break;
+							}
+						}
+					}
+				}
+				if (m > 0) {
+					ebuf_copy(rep, replen);
+					i += m;
+					done = op == '/';
+				}
+				else {
+					ebuf_copy(v + i, 1);
+					i++;
+				}
+			}
+			memmove(ebuf + mark, ebuf + r, elen - r);
+			elen = mark + elen - r;
+		}
+		return 0;
+	}
+	memmove(ebuf + mark, ebuf + v + start, n);
+	elen = mark + n;
+	return 0;
+}
+
+/* Expand the text from s to end, appending it to the scratch buffer.  In
+ * a pattern, escaped characters that are special to fnmatch() keep their
+ * backslash.  Returns -1 on error.
+ */
+static int expand_region(const char *s, const char *end, int pattern){
+	while (s < end) {
+		const char *p = s;
+		while (p < end && (*p < 0 || *p > CTL_MAX)) {
+			p++;
+		}
+		ebuf_append(s, p - s);
+		s = p;
+		if (s == end) {
+			break;
+		}
+
+		switch (*s) {
+		case CTL_ESC:
+			if (pattern && strchr("*?[]\\", s[1]) != 0) {
+				ebuf_append("\\", 1);
+			}
+			ebuf_append(s + 1, 1);
+			s += 2;
+			break;
+		case CTL_VAR:
+			p = strchr(s, CTL_END);
+			expand_var(s + 1, p - s - 1);
+			s = p + 1;
+			break;
+		case CTL_ARITH:
+			if ((p = expand_arith(s + 1)) == 0) {
+				return -1;
+			}
+			s = p + 1;
+			break;
+		case CTL_PARAM:
+			p = expand_end(s + 1);
+			if (expand_param(s + 1, p) < 0) {
+				return -1;
+			}
+			s = p + 1;
+			break;
+		default:
+			s++;
+		}
+	}
+	return 0;
+}
+
+/* Expand string s into the scratch buffer.  Returns -1 on error.
+ */
+static int expand_string(const char *s){
+	elen = 0;
+	return expand_region(s, s + strlen(s), 0);
+}
+
+int expand(command_t out, command_t in){
+	int i;
+
+	command_clear(out);
+	for (i = 0; i < in->argc; i++) {
+		if (in->argv[i] == 0) {
+			continue;
+		}
+		if (expand_string(in->argv[i]) < 0) {
+			return -1;
+		}
+		command_arg(out, ebuf, elen);
+	}
+	for (i = 0; i < in->nredirs; i++) {
+		struct redir *r = &in->redirs[i];
+		switch (r->type) {
+		case ELEMENT_REDIR_FILE_IN:
+		case ELEMENT_REDIR_FILE_OUT:
+		case ELEMENT_REDIR_FILE_APPEND:
+			if (expand_string(redir_name(in, r)) < 0) {
+				return -1;
+			}
+			command_add_redir(out, r->type, r->fd, 0, ebuf, elen);
+			break;
+		default:
+			command_add_redir(out, r->type, r->fd, r->target, 0, 0);
+		}
+	}
+	out->expand = 0;
+	out->pipein = in->pipein;
+	out->pipemore = in->pipemore;
+	return 0;
+}
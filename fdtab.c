@@ -0,0 +1,140 @@
+/* File descriptors of the shall that have a name.
+ *
+ * 'exec {NAME}<file' or 'exec {NAME}>file' opens the file once, on a free
+ * file descriptor of 10 or above, and records it in this table under
+ * NAME.  Later commands refer to it with '{NAME}' wherever a file
+ * descriptor can go, as in 'cmd >{NAME}', and the variable NAME is set to
+ * its number, for 'read -u $NAME'.  'exec {NAME}>&-' closes it.  Opening
+ * a name again keeps its number.
+ *
+ * The descriptors are close-on-exec, so commands only get them when a
+ * redirection asks for them.  A name is given a negative number by the
+ * parser, so that redirections keep fitting in their fixed-size records,
+ * and it is looked up when the command runs.
+ *
+ * The interface is as follows:
+ *	int fdtab_id(const char *name, unsigned int len):
+ *		Return the negative number that stands for the name.
+ *
+ *	int fdtab_lookup(int fd):
+ *		Return the file descriptor that fd stands for: fd itself if it
+ *		is not negative, else the one opened under the name, or -1 if
+ *		there is none.
+ *
+ *	int fdtab_fd(int fd):
+ *		The same, but complain if there is none.
+ *
+ *	int fdtab_open(int id, const char *file, int flags):
+ *	int fdtab_dup(int id, int fd):
+ *		Open the file, or duplicate fd, under the name.  Return the
+ *		file descriptor, or -1 on error.
+ *
+ *	int fdtab_close(int id):
+ *		Close the file descriptor of the name.  Returns -1 if there is
+ *		none.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include "shall.h"
+
+#define FDTAB_MIN		10			// lowest file descriptor given out
+#define FDTAB_ID(i)		(-2 - (i))
+#define FDTAB_INDEX(id)	(-2 - (id))
+
+static struct fdent {
+	char *name;
+	int fd;					// -1 if not open
+} *fdents;
+static int nfdents, maxfdents;
+
+int fdtab_id(const char *name, unsigned int len){
+	int i;
+
+	for (i = 0; i < nfdents; i++) {
+		if (strncmp(fdents[i].name, name, len) == 0 && fdents[i].name[len] == 0) {
+			return FDTAB_ID(i);
+		}
+	}
+	if (nfdents == maxfdents) {
+		maxfdents = maxfdents == 0 ? 8 : maxfdents * 2;
+		fdents = mem_realloc(MEM_EXEC, fdents, maxfdents * sizeof(*fdents));
+	}
+	fdents[nfdents].name = mem_alloc(MEM_EXEC, len + 1);
+	memcpy(fdents[nfdents].name, name, len);
+	fdents[nfdents].name[len] = 0;
+	fdents[nfdents].fd = -1;
+	return FDTAB_ID(nfdents++);
+}
+
+int fdtab_lookup(int fd){
+	return fd >= 0 ? fd : fdents[FDTAB_INDEX(fd)].fd;
+}
+
+int fdtab_fd(int fd){
+	int r = fdtab_lookup(fd);
+
+	if (r < 0) {
+		fprintf(stderr, "%s: no such file descriptor\n", fdents[FDTAB_INDEX(fd)].name);
+	}
+	return r;
+}
+
+/* Put newfd under the name, at the number it already has if any.
+ */
+static int fdtab_set(int id, int newfd){
+	struct fdent *fe = &fdents[FDTAB_INDEX(id)];
+	char num[16];
+
+	if (newfd < 0) {
+		return -1;
+	}
+	if (fe->fd >= 0) {
+		dup3(newfd, fe->fd, O_CLOEXEC);
+		close(newfd);
+	}
+	else if (newfd < FDTAB_MIN) {
+		fe->fd = fcntl(newfd, F_DUPFD_CLOEXEC, FDTAB_MIN);
+		close(newfd);
+	}
+	else {
+		fe->fd = newfd;
+	}
+	snprintf(num, sizeof(num), "%d", fe->fd);
+	var_set(fe->name, num);
+	return fe->fd;
+}
+
+int fdtab_open(int id, const char *file, int flags){
+	return fdtab_set(id, buf_open(file, flags));
+}
+
+int fdtab_dup(int id, int fd){
+	int newfd;
+
+	if ((fd = fdtab_fd(fd)) < 0) {
+		return -1;
+	}
+	if ((newfd = fcntl(fd, F_DUPFD_CLOEXEC, FDTAB_MIN)) < 0) {
+		perror("dup");
+		return -1;
+	}
+	return fdtab_set(id, newfd);
+}
+
+int fdtab_close(int id){
+	struct fdent *fe = &fdents[FDTAB_INDEX(id)];
+
+	if (fe->fd < 0) {
+		fprintf(stderr, "%s: no such file descriptor\n", fe->name);
+		return -1;
+	}
+	close(fe->fd);
+	fe->fd = -1;
+	var_unset(fe->name);
+	return 0;
+}
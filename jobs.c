@@ -0,0 +1,210 @@
+/* The job table: processes started in the background.
+ *
+ * Every process started with '&' is entered here, together with its
+ * group if it was started with '&group=NAME'.  The reaper takes it out
+ * again when it terminates, and keeps the number of jobs running, in
+ * total and per group, up to date, so that the builtin
+ *
+ *	wait group NAME
+ *
+ * can tell at once whether there is anything left to wait for in the
+ * group.  A script can so start its work in phases and wait for only one
+ * of them:
+ *
+ *	fetch a &group=fetch
+ *	fetch b &group=fetch
+ *	wait group fetch
+ *
+ * The exit statuses of jobs that terminated are queued for 'wait -n',
+ * which returns the next one, waiting for a job to terminate if there
+ * is none.  The queue keeps the last JOBS_MAXDONE.  Waiting for a group
+ * takes its jobs out of the queue.
+ *
+ * A group is given a number when its name is first seen, and a command
+ * started in the group has JOBS_GROUP plus that number as its
+ * 'background' argument, which stays true wherever it is only tested.
+ *
+ * The interface is as follows:
+ *	int jobs_group(const char *name):
+ *		Return the 'background' value for commands started in the
+ *		group name.
+ *
+ *	int jobs_find(const char *name):
+ *		The same, or -1 if no command was ever started in the group.
+ *
+ *	void jobs_add(int pid, int background):
+ *		Enter a process started in the background.
+ *
+ *	void jobs_reaped(int pid, int status):
+ *		Called by the reaper when a process terminated.
+ *
+ *	int jobs_running(int background):
+ *		Return the number of jobs running in the group that background
+ *		stands for, or in total if it stands for none.
+ *
+ *	int jobs_status(int background):
+ *		Return the status of the first job in the group that failed
+ *		since the last call, or 0, and start over.  The statuses of the
+ *		group leave the queue.
+ *
+ *	int jobs_next(int *status):
+ *		Take the next status from the queue.  Returns -1 if it is empty.
+ *
+ *	void jobs_forget():
+ *		Empty the queue, as after waiting for all jobs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shall.h"
+
+#define JOBS_BUCKETS	64
+#define JOBS_MAXDONE	1024
+
+/* Jobs are kept in an array, and linked by index + 1 (0 ends a list) in
+ * hash chains by pid, or in the list of free entries.
+ */
+static struct job {
+	int pid;
+	int group;				// index in groups, or -1
+	int next;
+} *jobs;
+static int njobs, maxjobs, freejobs;
+static int buckets[JOBS_BUCKETS];
+static int running;
+
+static struct group {
+	char *name;
+	int running;
+	int status;				// of the first failed job since jobs_status()
+} *groups;
+static int ngroups, maxgroups;
+
+static struct done {
+	int status;
+	int group;
+} done[JOBS_MAXDONE];			// statuses for 'wait -n'
+static unsigned int donefirst, ndone;
+
+static int jobs_index(const char *name){
+	int i;
+
+	for (i = 0; i < ngroups; i++) {
+		if (strcmp(groups[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+int jobs_find(const char *name){
+	int i = jobs_index(name);
+
+	return i < 0 ? -1 : JOBS_GROUP + i;
+}
+
+int jobs_group(const char *name){
+	int i = jobs_index(name);
+
+	if (i >= 0) {
+		return JOBS_GROUP + i;
+	}
+	if (ngroups == maxgroups) {
+		maxgroups = maxgroups == 0 ? 8 : maxgroups * 2;
+		groups = mem_realloc(MEM_EXEC, groups, maxgroups * sizeof(*groups));
+	}
+	groups[ngroups].name = mem_alloc(MEM_EXEC, strlen(name) + 1);
+	strcpy(groups[ngroups].name, name);
+	groups[ngroups].running = 0;
+	groups[ngroups].status = 0;
+	return JOBS_GROUP + ngroups++;
+}
+
+void jobs_add(int pid, int background){
+	int j;
+
+	if (freejobs != 0) {
+		j = freejobs - 1;
+		freejobs = jobs[j].next;
+	}
+	else {
+		if (njobs == maxjobs) {
+			maxjobs = maxjobs == 0 ? 16 : maxjobs * 2;
+			jobs = mem_realloc(MEM_EXEC, jobs, maxjobs * sizeof(*jobs));
+		}
+		j = njobs++;
+	}
+	jobs[j].pid = pid;
+	jobs[j].group = background >= JOBS_GROUP ? background - JOBS_GROUP : -1;
+	jobs[j].next = buckets[pid % JOBS_BUCKETS];
+	buckets[pid % JOBS_BUCKETS] = j + 1;
+	running++;
+	if (jobs[j].group >= 0) {
+		groups[jobs[j].group].running++;
+	}
+}
+
+void jobs_reaped(int pid, int status){
+	int *pj, j;
+
+	for (pj = &buckets[pid % JOBS_BUCKETS]; *pj != 0; pj = &jobs[*pj - 1].next) {
+		j = *pj - 1;
+		if (jobs[j].pid != pid) {
+			continue;
+		}
+		*pj = jobs[j].next;
+		jobs[j].next = freejobs;
+		freejobs = j + 1;
+		running--;
+		if (jobs[j].group >= 0) {
+			struct group *g = &groups[jobs[j].group];
+			g->running--;
+			if (g->status == 0) {
+				g->status = status;
+			}
+		}
+		if (ndone == JOBS_MAXDONE) {		// drop the oldest
+			donefirst = (donefirst + 1) % JOBS_MAXDONE;
+			ndone--;
+		}
+		struct done *d = &done[(donefirst + ndone++) % JOBS_MAXDONE];
+		d->status = status;
+		d->group = jobs[j].group;
+		return;
+	}
+}
+
+int jobs_running(int background){
+	return background >= JOBS_GROUP ? groups[background - JOBS_GROUP].running : running;
+}
+
+int jobs_status(int background){
+	struct group *g = &groups[background - JOBS_GROUP];
+	int status = g->status;
+	unsigned int i, n = 0;
+
+	for (i = 0; i < ndone; i++) {
+		struct done *d = &done[(donefirst + i) % JOBS_MAXDONE];
+		if (d->group != background - JOBS_GROUP) {
+			done[(donefirst + n++) % JOBS_MAXDONE] = *d;
+		}
+	}
+	ndone = n;
+	g->status = 0;
+	return status;
+}
+
+int jobs_next(int *status){
+	if (ndone == 0) {
+		return -1;
+	}
+	*status = done[donefirst].status;
+	donefirst = (donefirst + 1) % JOBS_MAXDONE;
+	ndone--;
+	return 0;
+}
+
+void jobs_forget(){
+	donefirst = ndone = 0;
+}
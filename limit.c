@@ -0,0 +1,162 @@
+/* Limiting the rate at which the shall starts processes.
+ *
+ * A script that runs away starting commands can fork tens of thousands
+ * of processes per second and stall the machine.  With a limit set, every
+ * fork() first takes a token from a bucket that holds at most 'burst'
+ * tokens and is refilled at 'rate' tokens per second.  When the bucket is
+ * empty the shall sleeps until there is a token again: commands are
+ * delayed, never refused.  So a script can start 'burst' commands at full
+ * speed, and after that 'rate' per second.  Without a limit, which is the
+ * default, the cost is a single test.
+ *
+ * The time spent waiting is kept, and printed by 'spawnlimit' without
+ * arguments.
+ *
+ * The interface is as follows:
+ *	int limit_set(double rate, double burst):
+ *		Allow rate spawns per second, with bursts of up to burst spawns.
+ *		A rate of 0 removes the limit.  Returns -1 if the values are
+ *		invalid.
+ *
+ *	int limit_parse(const char *spec):
+ *		Set the limit from a string 'rate[:burst]'.  Returns -1 if it is
+ *		invalid.
+ *
+ *	void limit_spawn():
+ *		Wait until a process may be spawned.  Called before fork().
+ *
+ *	int spawnlimit(command_t command):
+ *		The builtin: 'spawnlimit' prints the limit and how long spawns
+ *		waited, 'spawnlimit rate [burst]' sets the limit, and
+ *		'spawnlimit off' removes it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include "shall.h"
+
+static double rate;				// tokens per second, 0 if not limited
+static double burst;			// size of the bucket
+static double tokens;			// in the bucket
+static struct timespec refilled;	// when tokens was last brought up to date
+
+static unsigned long spawns;	// spawns since the limit was set
+static unsigned long delayed;	// of which had to wait
+static double waited;			// seconds spent waiting
+
+static double limit_now(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Add the tokens that came in since the last refill.
+ */
+static void limit_refill(){
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	tokens += ((now.tv_sec - refilled.tv_sec) + (now.tv_nsec - refilled.tv_nsec) / 1e9) * rate;
+	if (tokens > burst) {
+		tokens = burst;
+	}
+	refilled = now;
+}
+
+int limit_set(double r, double b){
+	if (r < 0 || b < 0) {
+		return -1;
+	}
+	if (b < 1) {
+		b = 1;
+	}
+	rate = r;
+	burst = b;
+	tokens = b;
+	clock_gettime(CLOCK_MONOTONIC, &refilled);
+	spawns = delayed = 0;
+	waited = 0;
+	return 0;
+}
+
+int limit_parse(const char *spec){
+	char *end;
+	double r, b;
+
+	r = strtod(spec, &end);
+	if (end == spec) {
+		return -1;
+	}
+	if (*end == ':') {
+		spec = end + 1;
+		b = strtod(spec, &end);
+		if (end == spec) {
+			return -1;
+		}
+	}
+	else {
+		b = r;				// a second's worth
+	}
+	if (*end != 0) {
+		return -1;
+	}
+	return limit_set(r, b);
+}
+
+void limit_spawn(){
+	if (rate == 0) {
+		return;
+	}
+	spawns++;
+	limit_refill();
+	if (tokens < 1) {
+		double start = limit_now(), wait = (1 - tokens) / rate;
+		struct timespec ts, rem;
+
+		ts.tv_sec = (time_t) wait;
+		ts.tv_nsec = (long) ((wait - ts.tv_sec) * 1e9);
+		while (nanosleep(&ts, &rem) < 0 && errno == EINTR) {
+			ts = rem;
+		}
+		delayed++;
+		waited += limit_now() - start;
+		limit_refill();
+	}
+	tokens -= 1;
+}
+
+int spawnlimit(command_t command){
+	int status = 0;
+
+	if (command->argc > 4) {
+		fprintf(stderr, "Usage: spawnlimit [rate [burst] | off]\n");
+		return 1;
+	}
+	if (command->argv[1] == 0) {
+		if (rate == 0) {
+			printf("no limit\n");
+		}
+		else {
+			printf("limit %g/s, burst %g: %lu spawns, %lu delayed, %.6f s waiting\n",
+								rate, burst, spawns, delayed, waited);
+		}
+		fflush(stdout);
+	}
+	else if (strcmp(command->argv[1], "off") == 0) {
+		status = limit_set(0, 0);
+	}
+	else {
+		char spec[128];
+		snprintf(spec, sizeof(spec), "%s:%s", command->argv[1],
+						command->argv[2] == 0 ? command->argv[1] : command->argv[2]);
+		if (limit_parse(spec) < 0) {
+			fprintf(stderr, "spawnlimit: bad rate or burst\n");
+			status = 1;
+		}
+	}
+	return status;
+}
@@ -0,0 +1,153 @@
+/* Accounting of memory allocation per subsystem.
+ *
+ * The subsystems allocate through the mem_*() macros in shall.h.  Unless
+ * the shall was started with -m these are plain malloc(), realloc() and
+ * free(), behind one predictable test.  With -m every block gets a small
+ * header that records its size and subsystem, and for each subsystem the
+ * number and size of the live blocks, the peak size and the number of
+ * allocations are kept.  The 'memstat' builtin prints them, and at the
+ * end of the input the blocks still allocated by subsystems that should
+ * have released everything by then are reported as leaks.
+ *
+ * The interface is as follows:
+ *	void mem_enable():
+ *		Start accounting.  Must be called before anything is allocated
+ *		through the macros, as blocks with and without headers cannot
+ *		be mixed.
+ *
+ *	void *mem_alloc_counted(enum mem_subsys subsys, size_t size, int zero):
+ *	void *mem_realloc_counted(enum mem_subsys subsys, void *p, size_t size):
+ *	void mem_free_counted(void *p):
+ *		The allocation functions used by the macros when accounting.
+ *
+ *	void mem_leaks():
+ *		Report the blocks that the subsystems which should have released
+ *		everything still hold.  Called when the shall exits normally.
+ *
+ *	int memstat(command_t command):
+ *		The builtin: print the statistics.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shall.h"
+
+int mem_enabled;
+
+/* Header in front of each block.  Its size keeps the block aligned as
+ * malloc() would.
+ */
+union mem_header {
+	struct {
+		size_t size;
+		enum mem_subsys subsys;
+	} h;
+	max_align_t align;
+};
+
+static struct mem_stats {
+	const char *name;
+	int transient;			// everything should be released at exit
+	size_t live, peak;		// bytes
+	unsigned long blocks;	// live blocks
+	unsigned long allocs;	// allocations, including reallocations
+} stats[MEM_NSUBSYS] = {
+	[MEM_READER] = { "reader", 1 },
+	[MEM_TOKEN] = { "token", 1 },
+	[MEM_PARSER] = { "parser", 1 },
+	[MEM_COMMAND] = { "command", 1 },
+	[MEM_SHALL] = { "shall", 1 },
+	[MEM_EXEC] = { "exec", 0 },
+	[MEM_VAR] = { "var", 0 },
+	[MEM_EXPAND] = { "expand", 0 },
+	[MEM_RECORD] = { "record", 0 },
+};
+
+static void mem_count(enum mem_subsys subsys, long bytes, int blocks){
+	struct mem_stats *s = &stats[subsys];
+
+	s->live += bytes;
+	s->blocks += blocks;
+	if (s->live > s->peak) {
+		s->peak = s->live;
+	}
+}
+
+void *mem_alloc_counted(enum mem_subsys subsys, size_t size, int zero){
+	union mem_header *m = zero ? calloc(1, sizeof(*m) + size) : malloc(sizeof(*m) + size);
+
+	if (m == 0) {
+		return 0;
+	}
+	m->h.size = size;
+	m->h.subsys = subsys;
+	stats[subsys].allocs++;
+	mem_count(subsys, size, 1);
+	return m + 1;
+}
+
+void *mem_realloc_counted(enum mem_subsys subsys, void *p, size_t size){
+	if (p == 0) {
+		return mem_alloc_counted(subsys, size, 0);
+	}
+
+	union mem_header *m = (union mem_header *) p - 1;
+	size_t old = m->h.size;
+	subsys = m->h.subsys;
+	if ((m = realloc(m, sizeof(*m) + size)) == 0) {
+		return 0;
+	}
+	m->h.size = size;
+	stats[subsys].allocs++;
+	mem_count(subsys, (long) size - (long) old, 0);
+	return m + 1;
+}
+
+void mem_free_counted(void *p){
+	if (p != 0) {
+		union mem_header *m = (union mem_header *) p - 1;
+		mem_count(m->h.subsys, -(long) m->h.size, -1);
+		free(m);
+	}
+}
+
+static void mem_print(FILE *fp){
+	int i;
+
+	fprintf(fp, "%-10s %12s %8s %12s %10s\n", "subsystem", "live bytes", "blocks", "peak bytes", "allocs");
+	for (i = 0; i < MEM_NSUBSYS; i++) {
+		struct mem_stats *s = &stats[i];
+		fprintf(fp, "%-10s %12zu %8lu %12zu %10lu\n", s->name, s->live, s->blocks, s->peak, s->allocs);
+	}
+}
+
+void mem_leaks(){
+	int i;
+
+	if (!mem_enabled) {
+		return;
+	}
+	for (i = 0; i < MEM_NSUBSYS; i++) {
+		struct mem_stats *s = &stats[i];
+		if (s->transient && s->blocks > 0) {
+			fprintf(stderr, "memstat: %s: %lu blocks, %zu bytes not released at exit\n",
+												s->name, s->blocks, s->live);
+		}
+	}
+}
+
+void mem_enable(){
+	mem_enabled = 1;
+}
+
+int memstat(command_t command){
+	if (!mem_enabled) {
+		fprintf(stderr, "memstat: not enabled, start the shall with -m\n");
+		return 1;
+	}
+	mem_print(stdout);
+	fflush(stdout);
+	return 0;
+}
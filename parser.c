@@ -6,6 +6,7 @@
  *
  *		ELT_ARG:	an argument (essentially just a string)
  *		ELT_REDIR:	an I/O redirection
+ *		ELT_PIPE:	a pipe from the command before to the one after
  *
  * There are three types of I/O redirection: input (<), output, (>),
  * and append (>>).  Redirection can either involve a file name or
@@ -15,7 +16,16 @@
  *
  *	program
  *		: element* EOF
- *		| element* [ semicolon | ampersand | newline ] program
+ *		| element* [ semicolon | background | newline | pipe ] program
+ *		;
+ *
+ *	background
+ *		: AMPERSAND						// in the background
+ *		| AMPERSAND 'group=NAME'		// the same, in a group (see jobs.c);
+ *		;								// no space after the ampersand
+ *
+ *	pipe
+ *		: fd? BAR						// fd defaults to 1
  *		;
  *
  *  element
@@ -23,22 +33,36 @@
  *		| fd? LT [ fd | string ]		// input redirection
  *		| fd? GT [ fd | string ]		// output redirection
  *		| fd? GT GT string				// append
+ *		| fd? [ LT | GT ] AMPERSAND '-'	// close
  *		;
  *
  *	fd
- *		: '{' string '}'
+ *		: '{' string '}'				// a number, or a name (see fdtab.c)
  *		;
  *
  * The module exports two function:
  *
  *	parser_t parser_create(tokenizer_t tokenizer);
- *	element_t *parse_next(parser_t parser);
- *	void element_free(element_t);
+ *	void parser_next(parser_t parser, element_t elt);
+ *	void element_release(element_t);
  *	void parser_free(parser_t);
+ *	void parser_set_check(parser_t parser, int check);
+ *	unsigned int parser_line(parser_t parser);
+ *
+ * A newline always ends the command: a redirection left unfinished at
+ * the end of a line is an error on that line, rather than taking its
+ * file from the next one.
+ *
+ * In check mode (used by 'shall -n'), after a pattern with an error the
+ * parser skips the rest of the command, up to the next newline or ';',
+ * and goes on from there.  So every command is checked as the shall
+ * would run it, rather than with tokens left over from the error.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include "shall.h"
 
@@ -48,36 +72,46 @@
  */
 #define MAX_TOKENS		7
 
+#define PARSER_GROUP	"group="
+#define PARSER_GROUPLEN	6
+
 struct parser {
 	enum {
 		PARSER_NEUTRAL,
 		PARSER_ERROR,
+		PARSER_RESYNC,				// check mode: skipping to the next command
 		PARSER_EOF
 	} state;
 	tokenizer_t tokenizer;
-	token_t tokens[MAX_TOKENS];
+	struct token tokens[MAX_TOKENS];
 	unsigned int ntokens;
 	unsigned int line;
+	int check;						// report every error, see above
+
+	/* A token that was looked at ahead and put back.
+	 */
+	struct token pending[1];
+	unsigned int npending;
 };
 
-void element_free(element_t elt){
+/* Release the string of an element.
+ */
+void element_release(element_t elt){
 	switch (elt->type) {//
 	case ELEMENT_ARG:
-		free(elt->u.arg.string);
-		break;
 	case ELEMENT_REDIR_FILE_IN:
 	case ELEMENT_REDIR_FILE_OUT:
 	case ELEMENT_REDIR_FILE_APPEND:
-		free(elt->u.redir_file.name);
+	case ELEMENT_BACKGROUND:
+		sstring_free(&elt->string);
 		break;
 	default:
 		break;
 	}
-	free(elt);
 }
 
 parser_t parser_create(tokenizer_t tokenizer){
-	parser_t parser = (parser_t) calloc(1, sizeof(*parser));
+	parser_t parser = (parser_t) mem_calloc(MEM_PARSER, sizeof(*parser));
 	parser->tokenizer = tokenizer;
 	parser->line = 1;
 	return parser;
@@ -87,32 +121,69 @@ static void parser_truncate(parser_t parser){
 	unsigned int i;
 
 	for (i = 0; i < parser->ntokens; i++) {
-		token_free(parser->tokens[i]);
+		token_release(&parser->tokens[i]);
 	}
 	parser->ntokens = 0;
 }
 
-static element_t element_create(enum element_type et){
-	element_t elt = calloc(1, sizeof(*elt));
+/* Put a token back, to be the next one read.
+ */
+static void parser_unget(parser_t parser, token_t token){
+	assert(parser->npending == 0);
+	parser->pending[0] = *token;
+	parser->npending = 1;
+}
 
+/* Initialize an element of the given type.  Returns 1 so that a complete
+ * match can be returned in one go.
+ */
+static int element_create(element_t elt, enum element_type et){
+	memset(elt, 0, sizeof(*elt));
 	elt->type = et;
-	return elt;
+	return 1;
+}
+
+/* Move the string of a token into an element.
+ */
+static void element_take(element_t elt, token_t token){
+	elt->string = token->string;
+	token->string.len = 0;
 }
 
-/* See if the current list of tokens is a complete pattern.
+/* Return the file descriptor in a '{ fd }' token: a number, or the
+ * negative number that the fd table gives a name.  Returns -1 if it is
+ * neither.
  */
-static element_t parser_match(parser_t parser){
+static int parser_fd(token_t token){
+	const char *s = sstring_get(&token->string);
+	unsigned int i;
+
+	for (i = 0; i < token->string.len && isdigit((unsigned char) s[i]); i++)
+		;
+	if (i > 0 && i == token->string.len) {
+		return atoi(s);
+	}
+	if (var_name(s, token->string.len)) {
+		return fdtab_id(s, token->string.len);
+	}
+	return -1;
+}
+
+/* See if the current list of tokens is a complete pattern.  If so, fill
+ * in the element and return 1.
+ */
+static int parser_match(parser_t parser, element_t elt){
 	assert(parser->ntokens > 0);
-	unsigned int offset, fd;
-	element_t elt;
+	unsigned int offset;
+	int fd;
+	struct token *tokens = parser->tokens;
 
-	switch (parser->tokens[0]->type) {
+	switch (tokens[0].type) {
 	case TOKEN_STRING:
 		assert(parser->ntokens == 1);
-		elt = element_create(ELEMENT_ARG);
-		elt->u.arg.string = parser->tokens[0]->u.string;
-		parser->tokens[0]->u.string = 0;
-		return elt;
+		element_create(elt, ELEMENT_ARG);
+		element_take(elt, &tokens[0]);
+		return 1;
 	case TOKEN_LT:
 		fd = 0;
 		offset = 0;
@@ -121,37 +192,52 @@ static element_t parser_match(parser_t parser){
 		fd = 1;
 		offset = 0;
 		break;
+	case TOKEN_PIPE:
+		element_create(elt, ELEMENT_PIPE);
+		elt->fd1 = 1;
+		return 1;
 	case TOKEN_CB_OPEN:
 		if (parser->ntokens < 2) {
 			return 0;
 		}
-		if (parser->tokens[1]->type != TOKEN_STRING) {
+		if (tokens[1].type != TOKEN_STRING) {
+			fprintf(stderr, "line %u: expected a file descriptor\n", parser->line);
+			return element_create(elt, ELEMENT_ERROR);
+		}
+		if ((fd = parser_fd(&tokens[1])) == -1) {
 			fprintf(stderr, "line %u: expected a file descriptor\n", parser->line);
-			return element_create(ELEMENT_ERROR);
+			return element_create(elt, ELEMENT_ERROR);
 		}
-		fd = atoi(parser->tokens[1]->u.string);
 		if (parser->ntokens < 3) {
 			return 0;
 		}
-		if (parser->tokens[2]->type != TOKEN_CB_CLOSE) {
+		if (tokens[2].type != TOKEN_CB_CLOSE) {
 			fprintf(stderr, "line %u: expected a '}'\n", parser->line);
-			return element_create(ELEMENT_ERROR);
+			return element_create(elt, ELEMENT_ERROR);
 		}
 		if (parser->ntokens < 4) {
 			return 0;
 		}
-		switch (parser->tokens[3]->type) {
+		switch (tokens[3].type) {
 		case TOKEN_LT: case TOKEN_GT:
 			offset = 3;
 			break;
+		case TOKEN_PIPE:
+			if (fd < 1) {
+				fprintf(stderr, "line %u: bad file descriptor for a pipe\n", parser->line);
+				return element_create(elt, ELEMENT_ERROR);
+			}
+			element_create(elt, ELEMENT_PIPE);
+			elt->fd1 = fd;
+			return 1;
 		default:
 			fprintf(stderr, "line %u: expected a redirection character\n", parser->line);
-			return element_create(ELEMENT_ERROR);
+			return element_create(elt, ELEMENT_ERROR);
 		}
 		break;
 	default:
 		fprintf(stderr, "line %u: unexpected token\n", parser->line);
-		return element_create(ELEMENT_ERROR);
+		return element_create(elt, ELEMENT_ERROR);
 	}
 
 	/* We're in the process of matching a redirection.  The last token at
@@ -164,149 +250,247 @@ static element_t parser_match(parser_t parser){
 
 	/* Match for '>> file'.
 	 */
-	if (parser->tokens[offset + 1]->type == TOKEN_GT) {
-		if (parser->tokens[offset]->type != TOKEN_GT) {
+	if (tokens[offset + 1].type == TOKEN_GT) {
+		if (tokens[offset].type != TOKEN_GT) {
 			fprintf(stderr, "line %u: expected >>\n", parser->line);
-			return element_create(ELEMENT_ERROR);
+			return element_create(elt, ELEMENT_ERROR);
 		}
 		if (offset == parser->ntokens - 2) {
 			return 0;
 		}
-		if (parser->tokens[offset + 2]->type != TOKEN_STRING) {
+		if (tokens[offset + 2].type != TOKEN_STRING) {
 			fprintf(stderr, "line %u: expected >> string\n", parser->line);
-			return element_create(ELEMENT_ERROR);
+			return element_create(elt, ELEMENT_ERROR);
 		}
-		elt = element_create(ELEMENT_REDIR_FILE_APPEND);
-		elt->u.redir_file.fd = fd;
-		elt->u.redir_file.name = parser->tokens[offset + 2]->u.string;
-		parser->tokens[offset + 2]->u.string = 0;
-		return elt;
+		element_create(elt, ELEMENT_REDIR_FILE_APPEND);
+		elt->fd1 = fd;
+		element_take(elt, &tokens[offset + 2]);
+		return 1;
+	}
+
+	/* Match for '>&-'.
+	 */
+	if (tokens[offset + 1].type == TOKEN_AMPERSAND) {
+		if (offset == parser->ntokens - 2) {
+			return 0;
+		}
+		if (tokens[offset + 2].type != TOKEN_STRING
+						|| strcmp(sstring_get(&tokens[offset + 2].string), "-") != 0) {
+			fprintf(stderr, "line %u: expected >&-\n", parser->line);
+			return element_create(elt, ELEMENT_ERROR);
+		}
+		element_create(elt, ELEMENT_REDIR_CLOSE);
+		elt->fd1 = fd;
+		return 1;
 	}
 
 	/* Next should be a file or a fd.
 	 */
-	switch (parser->tokens[offset + 1]->type) {
+	switch (tokens[offset + 1].type) {
 	case TOKEN_STRING:
 		assert(offset == parser->ntokens - 2);
-		elt = element_create(
-							parser->tokens[offset]->type == TOKEN_LT
+		element_create(elt,
+							tokens[offset].type == TOKEN_LT
 							? ELEMENT_REDIR_FILE_IN
 							: ELEMENT_REDIR_FILE_OUT);
-		elt->u.redir_file.fd = fd;
-		elt->u.redir_file.name = parser->tokens[offset + 1]->u.string;
-		parser->tokens[offset + 1]->u.string = 0;
-		return elt;
+		elt->fd1 = fd;
+		element_take(elt, &tokens[offset + 1]);
+		return 1;
 	case TOKEN_CB_OPEN:
 		if (parser->ntokens < offset + 3) {
 			return 0;
 		}
-		if (parser->tokens[offset + 2]->type != TOKEN_STRING) {
+		if (tokens[offset + 2].type != TOKEN_STRING) {
 			fprintf(stderr, "line %u: expected a file descriptor\n", parser->line);
-			return element_create(ELEMENT_ERROR);
+			return element_create(elt, ELEMENT_ERROR);
 		}
 		if (parser->ntokens < offset + 4) {
 			return 0;
 		}
-		if (parser->tokens[offset + 3]->type != TOKEN_CB_CLOSE) {
+		if (tokens[offset + 3].type != TOKEN_CB_CLOSE) {
 			fprintf(stderr, "line %u: expected a '}'\n", parser->line);
-			return element_create(ELEMENT_ERROR);
+			return element_create(elt, ELEMENT_ERROR);
 		}
-		elt = element_create(
-							parser->tokens[offset]->type == TOKEN_LT
+		element_create(elt,
+							tokens[offset].type == TOKEN_LT
 							? ELEMENT_REDIR_FD_IN
 							: ELEMENT_REDIR_FD_OUT);
-		elt->u.redir_fd.fd1 = fd;
-		elt->u.redir_fd.fd2 = atoi(parser->tokens[offset + 2]->u.string);
-		return elt;
+		elt->fd1 = fd;
+		if ((elt->fd2 = parser_fd(&tokens[offset + 2])) == -1) {
+			fprintf(stderr, "line %u: expected a file descriptor\n", parser->line);
+			return element_create(elt, ELEMENT_ERROR);
+		}
+		return 1;
 	default:
 		fprintf(stderr, "line %u: expected file or fd\n", parser->line);
-		return element_create(ELEMENT_ERROR);
+		return element_create(elt, ELEMENT_ERROR);
 	}
 
 	return 0;
 }
 
-/* Get the next element.
+/* Get the next token: the one put back if there is one.
+ */
+static void parser_token(parser_t parser, token_t token){
+	if (parser->npending > 0) {
+		*token = parser->pending[0];
+		parser->npending = 0;
+	}
+	else {
+		tokenizer_next(parser->tokenizer, token);
+	}
+}
+
+/* A background element takes the name of its group from a 'group=NAME'
+ * string right after the ampersand.  Any other token is put back.
  */
-element_t parser_next(parser_t parser){
+static void parser_group(parser_t parser, element_t elt){
+	struct token token;
+	unsigned int len;
+
+	parser_token(parser, &token);
+	if (token.type != TOKEN_STRING || !token.glued || token.string.len <= PARSER_GROUPLEN
+			|| strncmp(sstring_get(&token.string), PARSER_GROUP, PARSER_GROUPLEN) != 0) {
+		parser_unget(parser, &token);
+		return;
+	}
+	len = token.string.len - PARSER_GROUPLEN;
+	if (len < SSTRING_INLINE) {
+		memcpy(elt->string.u.buf, sstring_get(&token.string) + PARSER_GROUPLEN, len + 1);
+		token_release(&token);
+	}
+	else {
+		elt->string.u.ptr = token.string.u.ptr;
+		memmove(elt->string.u.ptr, elt->string.u.ptr + PARSER_GROUPLEN, len + 1);
+	}
+	elt->string.len = len;
+}
+
+/* Get the next element.  The string in the element should be released
+ * with element_release().
+ */
+void parser_next(parser_t parser, element_t elt){
 	for (;;) {
-		token_t token = tokenizer_next(parser->tokenizer);
+		struct token token;
+
+		parser_token(parser, &token);
 
 		switch (parser->state) {
 		case PARSER_NEUTRAL:
-			switch (token->type) {
+			switch (token.type) {
 			case TOKEN_EOF:
-				token_free(token);
+				token_release(&token);
 				if (parser->ntokens > 0) {
-					fprintf(stderr, "Line %d: unrecognized eof\n", parser->line);
+					fprintf(stderr, "line %u: unrecognized eof\n", parser->line);
 					parser_truncate(parser);
-					return element_create(ELEMENT_ERROR);
+					element_create(elt, ELEMENT_ERROR);
+					return;
 				}
 				else {
-					return element_create(ELEMENT_EOF);
+					element_create(elt, ELEMENT_EOF);
+					return;
 				}
 			case TOKEN_EOLN:
-				token_free(token);
-				parser->line++;
-				if (parser->ntokens == 0) {
-					return element_create(ELEMENT_EOLN);
+				if (parser->ntokens > 0) {		// a redirection cut short
+					fprintf(stderr, "line %u: unexpected newline\n", parser->line);
+					parser_truncate(parser);
+					parser_unget(parser, &token);
+					element_create(elt, ELEMENT_ERROR);
+					return;
 				}
-				break;
+				token_release(&token);
+				parser->line++;
+				element_create(elt, ELEMENT_EOLN);
+				return;
 			case TOKEN_SEMI:
-				token_free(token);
+				token_release(&token);
 				if (parser->ntokens == 0) {
-					return element_create(ELEMENT_SEMI);
+					element_create(elt, ELEMENT_SEMI);
+					return;
 				}
 				else {
-					fprintf(stderr, "Line %d: unrecognized semicolon\n", parser->line);
+					fprintf(stderr, "line %u: unrecognized semicolon\n", parser->line);
 					parser_truncate(parser);
-					return element_create(ELEMENT_ERROR);
+					element_create(elt, ELEMENT_ERROR);
+					return;
 				}
 				break;
 			case TOKEN_AMPERSAND:
-				token_free(token);
+				if (parser->ntokens > 0 && (parser->tokens[parser->ntokens - 1].type == TOKEN_GT
+								|| parser->tokens[parser->ntokens - 1].type == TOKEN_LT)) {
+					goto pattern;		// '>&-'
+				}
+				token_release(&token);
 				if (parser->ntokens == 0) {
-					return element_create(ELEMENT_BACKGROUND);
+					element_create(elt, ELEMENT_BACKGROUND);
+					parser_group(parser, elt);
+					return;
 				}
 				else {
-					fprintf(stderr, "Line %d: unrecognized ampersand\n", parser->line);
+					fprintf(stderr, "line %u: unrecognized ampersand\n", parser->line);
 					parser_truncate(parser);
-					return element_create(ELEMENT_ERROR);
+					element_create(elt, ELEMENT_ERROR);
+					return;
 				}
 				break;
 			default:
+			pattern:
 				assert(parser->ntokens < MAX_TOKENS);
 				parser->tokens[parser->ntokens++] = token;
-				element_t elt = parser_match(parser);
-				if (elt != 0) {
+				if (parser_match(parser, elt)) {
 					parser_truncate(parser);
-					return elt;
+					if (parser->check && elt->type == ELEMENT_ERROR) {
+						parser->state = PARSER_RESYNC;
+					}
+					return;
 				}
 				if (parser->ntokens == MAX_TOKENS) {
-					fprintf(stderr, "Line %d: pattern too long %d\n", parser->line, token->type);
+					fprintf(stderr, "line %u: pattern too long %d\n", parser->line, token.type);
 					parser_truncate(parser);
 					parser->state = PARSER_ERROR;
-					return element_create(ELEMENT_ERROR);
+					element_create(elt, ELEMENT_ERROR);
+					return;
 				}
 			}
 			break;
 		case PARSER_ERROR:
-			if (token->type == TOKEN_EOLN) {
+			if (token.type == TOKEN_EOLN) {
 				parser_truncate(parser);
 				parser->state = PARSER_NEUTRAL;
 			}
-			token_free(token);
+			token_release(&token);
+			break;
+		case PARSER_RESYNC:
+			if (token.type == TOKEN_EOLN || token.type == TOKEN_SEMI || token.type == TOKEN_EOF) {
+				parser_unget(parser, &token);
+				parser->state = PARSER_NEUTRAL;
+			}
+			else {
+				token_release(&token);
+			}
 			break;
 		case PARSER_EOF:
 			assert(parser->ntokens == 0);
-			token_free(token);
-			return element_create(ELEMENT_EOF);
+			token_release(&token);
+			element_create(elt, ELEMENT_EOF);
+			return;
 		default:
 			assert(0);
 		}
 	}
 }
 
+void parser_set_check(parser_t parser, int check){
+	parser->check = check;
+}
+
+unsigned int parser_line(parser_t parser){
+	return parser->line;
+}
+
 void parser_free(parser_t parser){
-	free(parser);
+	while (parser->npending > 0) {
+		token_release(&parser->pending[--parser->npending]);
+	}
+	mem_free(parser);
 }
@@ -0,0 +1,309 @@
+/* Lookup of commands in $PATH.
+ *
+ * The file found for a command name is remembered in a hash table, so
+ * that running the same command again costs one stat() rather than a
+ * failed execv() for every directory in $PATH before the right one.  An
+ * entry is used as long as the file has the same inode, size and
+ * modification time; otherwise the command is looked up again.  All
+ * entries are dropped when $PATH changes.
+ *
+ * With the file, the entry records whether it is a shall script, that
+ * is, whether its first line is '#!' followed by a path to shall (or
+ * 'env shall').  Such scripts are run by the shall that is already
+ * running instead of starting a new one.
+ *
+ * Even so, execv() has the kernel walk the path of the file again, which
+ * costs on deep or slow file systems such as overlays.  So a command that
+ * is run a second time gets a handle: an O_PATH descriptor of its file,
+ * kept open (close-on-exec) for as long as the entry is valid.  The child
+ * then checks that the handle still has the inode and modification time
+ * of the entry, with an fstat() that walks nothing, and runs it with
+ * execveat(AT_EMPTY_PATH).  Scripts get no handle: the kernel would pass
+ * their interpreter /dev/fd/N rather than the path, so $0 would change
+ * after the first run.  At most PATH_MAXHANDLES are kept.
+ *
+ * The interface is as follows:
+ *	const char *path_lookup(const char *name, int *script):
+ *		Return the file that executing 'name' runs, or 0 if there is
+ *		none.  Sets *script to 1 if it is a shall script.  The result
+ *		is valid until the next call.
+ *
+ *	int path_handle(const char *file):
+ *		Return the handle of file as returned by the last path_lookup(),
+ *		or -1 if it has none.  A child must keep it open until it runs
+ *		path_exec().
+ *
+ *	void path_exec(const char *file, char **argv):
+ *		Execute file, through its handle if it has one.  Returns only
+ *		if that fails.
+ *
+ *	void path_seed(const char *name, const char *file):
+ *		Enter file as what name runs, as resolved ahead of time by
+ *		shallc, so that it is used without searching $PATH for as long
+ *		as it is the same file.
+ */
+
+#define _GNU_SOURCE
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <ctype.h>
+#include "shall.h"
+
+#define PATH_BUCKETS	64
+#define PATH_MAXHANDLES	64
+#define PATH_MINHANDLE	64		// above the descriptors commands use
+
+extern char **environ;
+
+struct pathent {
+	struct pathent *next;
+	char *name;				// the command name
+	char *file;				// the file found for it
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	int script;				// starts with #! naming shall
+	int interp;				// starts with #!
+	int handle;				// O_PATH descriptor of file, or -1
+	unsigned long uses;
+};
+
+static struct pathent *pathents[PATH_BUCKETS];
+static struct pathent *lastpe;	// result of the last path_lookup()
+static char *pathvar;		// $PATH that the entries were found with
+static int nhandles;
+
+static void path_drop_handle(struct pathent *pe){
+	if (pe->handle >= 0) {
+		close(pe->handle);
+		pe->handle = -1;
+		nhandles--;
+	}
+}
+
+static unsigned int path_hash(const char *name){
+	unsigned int h = 5381;
+
+	while (*name != 0) {
+		h = h * 33 + (unsigned char) *name++;
+	}
+	return h % PATH_BUCKETS;
+}
+
+static void path_flush(){
+	int i;
+
+	for (i = 0; i < PATH_BUCKETS; i++) {
+		while (pathents[i] != 0) {
+			struct pathent *pe = pathents[i];
+			pathents[i] = pe->next;
+			path_drop_handle(pe);
+			free(pe->name);
+			free(pe->file);
+			free(pe);
+		}
+	}
+	lastpe = 0;
+}
+
+/* Return 1 if the interpreter named by a '#!' line is shall.  Sets
+ * *interp to 1 if there is a '#!' line at all.
+ */
+static int path_shebang(const char *file, int *interp){
+	char line[128], *p, *word;
+	int fd, n;
+
+	if ((fd = open(file, O_RDONLY | O_CLOEXEC)) < 0) {
+		return 0;
+	}
+	n = read(fd, line, sizeof(line) - 1);
+	close(fd);
+	if (n < 2 || line[0] != '#' || line[1] != '!') {
+		return 0;
+	}
+	*interp = 1;
+	line[n] = 0;
+
+	/* Look at the basename of the interpreter, and at the first argument
+	 * if the interpreter is env.
+	 */
+	for (p = line + 2; *p == ' ' || *p == '\t'; p++)
+		;
+	word = p;
+	while (*p != 0 && !isspace((unsigned char) *p)) {
+		if (*p++ == '/') {
+			word = p;
+		}
+	}
+	if (p - word == 3 && strncmp(word, "env", 3) == 0) {
+		while (*p == ' ' || *p == '\t') {
+			p++;
+		}
+		for (word = p; *p != 0 && !isspace((unsigned char) *p); p++)
+			;
+	}
+	return p - word == 5 && strncmp(word, "shall", 5) == 0
+						&& (*p == 0 || isspace((unsigned char) *p));
+}
+
+/* Make file, with the given attributes, the one that the entry runs.
+ */
+static void path_set(struct pathent *pe, char *file, struct stat *st){
+	pe->file = file;
+	pe->dev = st->st_dev;
+	pe->ino = st->st_ino;
+	pe->size = st->st_size;
+	pe->mtime = st->st_mtim;
+	pe->interp = 0;
+	pe->script = S_ISREG(st->st_mode) && path_shebang(file, &pe->interp);
+	pe->uses = 0;
+}
+
+/* Fill in the file of the entry for pe->name, or return -1 if there is
+ * none.
+ */
+static int path_resolve(struct pathent *pe){
+	const char *path = pathvar;
+	char *file = 0;
+	struct stat st;
+
+	free(pe->file);
+	pe->file = 0;
+	path_drop_handle(pe);
+	if (strchr(pe->name, '/') != 0) {
+		if (stat(pe->name, &st) < 0) {
+			return -1;
+		}
+		file = strdup(pe->name);
+	}
+	else {
+		for (;;) {
+			const char *r = strchr(path, ':');
+			int len = r == 0 ? strlen(path) : r - path;
+
+			file = realloc(file, len + strlen(pe->name) + 2);
+			if (len == 0) {
+				strcpy(file, pe->name);
+			}
+			else {
+				sprintf(file, "%.*s/%s", len, path, pe->name);
+			}
+			if (stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, X_OK) == 0) {
+				break;
+			}
+			if (r == 0) {
+				free(file);
+				return -1;
+			}
+			path = r + 1;
+		}
+	}
+
+	path_set(pe, file, &st);
+	return 0;
+}
+
+/* Open a handle for the entry, which is run a second time.
+ */
+static void path_open_handle(struct pathent *pe){
+	int fd;
+
+	if (nhandles >= PATH_MAXHANDLES || pe->interp
+						|| (fd = open(pe->file, O_PATH | O_CLOEXEC)) < 0) {
+		return;
+	}
+	pe->handle = fcntl(fd, F_DUPFD_CLOEXEC, PATH_MINHANDLE);
+	close(fd);
+	if (pe->handle >= 0) {
+		nhandles++;
+	}
+}
+
+/* Return the entry for name, creating it if there is none.  Drop all
+ * entries first if $PATH has changed.
+ */
+static struct pathent *path_entry(const char *name){
+	const char *path = getenv("PATH");
+	struct pathent *pe;
+
+	if (path == 0) {
+		path = "";
+	}
+	if (pathvar == 0 || strcmp(path, pathvar) != 0) {
+		path_flush();
+		free(pathvar);
+		pathvar = strdup(path);
+	}
+
+	unsigned int h = path_hash(name);
+	for (pe = pathents[h]; pe != 0; pe = pe->next) {
+		if (strcmp(pe->name, name) == 0) {
+			return pe;
+		}
+	}
+	pe = calloc(1, sizeof(*pe));
+	pe->name = strdup(name);
+	pe->handle = -1;
+	pe->next = pathents[h];
+	pathents[h] = pe;
+	return pe;
+}
+
+void path_seed(const char *name, const char *file){
+	struct pathent *pe = path_entry(name);
+	struct stat st;
+
+	if (stat(file, &st) == 0 && S_ISREG(st.st_mode)) {
+		free(pe->file);
+		path_drop_handle(pe);
+		path_set(pe, strdup(file), &st);
+	}
+}
+
+const char *path_lookup(const char *name, int *script){
+	struct pathent *pe = path_entry(name);
+	struct stat st;
+
+	if (pe->file != 0 && stat(pe->file, &st) == 0
+					&& st.st_dev == pe->dev && st.st_ino == pe->ino
+					&& st.st_size == pe->size
+					&& st.st_mtim.tv_sec == pe->mtime.tv_sec
+					&& st.st_mtim.tv_nsec == pe->mtime.tv_nsec) {
+		if (++pe->uses == 1 && pe->handle < 0) {
+			path_open_handle(pe);
+		}
+		lastpe = pe;
+		*script = pe->script;
+		return pe->file;
+	}
+
+	lastpe = 0;
+	if (path_resolve(pe) < 0) {
+		return 0;
+	}
+	lastpe = pe;
+	*script = pe->script;
+	return pe->file;
+}
+
+int path_handle(const char *file){
+	return lastpe != 0 && file == lastpe->file ? lastpe->handle : -1;
+}
+
+void path_exec(const char *file, char **argv){
+	struct pathent *pe = lastpe;
+	struct stat st;
+
+	if (pe != 0 && file == pe->file && pe->handle >= 0 && fstat(pe->handle, &st) == 0
+					&& st.st_dev == pe->dev && st.st_ino == pe->ino
+					&& st.st_mtim.tv_sec == pe->mtime.tv_sec
+					&& st.st_mtim.tv_nsec == pe->mtime.tv_nsec) {
+		execveat(pe->handle, "", argv, environ, AT_EMPTY_PATH);
+	}
+	execv(file, argv);
+}
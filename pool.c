@@ -0,0 +1,399 @@
+/* Pools of worker processes.
+ *
+ * A command such as 'python3 tool.py args' spends most of its time
+ * starting the interpreter.  Instead, a pool of long-lived workers can be
+ * defined once,
+ *
+ *	pool tools 4 python3 worker.py
+ *
+ * and a command prefixed with '@pool tools' is then sent as a request to
+ * one of the workers, which runs it without starting anything:
+ *
+ *	@pool tools tool.py args < in > out
+ *
+ * Workers are started when they are first needed, up to the number given,
+ * and started again if they die.  When its pool is redefined, a worker
+ * is sent SIGTERM, and SIGKILL if it is still there a second later.  A worker reads requests on its standard
+ * input and writes replies on its standard output, which are both one end
+ * of a socket pair.  All numbers are 32 bits in the byte order of the
+ * machine:
+ *
+ *	request:	length, then that many bytes: the working directory and
+ *				the arguments, each terminated by a null character.
+ *				Standard input, output and error of the command, after
+ *				its redirections, come along as three file descriptors
+ *				(SCM_RIGHTS) with the length.
+ *	reply:		length (4), then the exit status.
+ *
+ * A request in the background gets its reply when the worker is needed
+ * again; the status is then reported like that of a background process.
+ *
+ * The interface is as follows:
+ *	int pool(command_t command):
+ *		The builtin: 'pool NAME N command ...' defines a pool, 'pool'
+ *		lists them.
+ *
+ *	int pool_run(command_t command, int background):
+ *		Run '@pool NAME command ...'.  Returns the exit status.
+ */
+
+#define _GNU_SOURCE
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <errno.h>
+#include "shall.h"
+
+#define MAX_WORKERS		64
+#define WORKER_GRACE	1000		// ms a worker gets to exit after SIGTERM
+
+struct worker {
+	int pid;				// 0 if not running
+	int fd;					// our end of the socket pair
+	int busy;				// a request is outstanding
+	int background;			// and nobody is waiting for its reply
+};
+
+static struct pool {
+	struct pool *next;
+	char *name;
+	char **argv;			// command that starts a worker
+	int nworkers;
+	struct worker workers[MAX_WORKERS];
+	unsigned long requests, restarts;
+} *pools;
+
+/* Buffer for building requests, kept between them.
+ */
+static char *reqbuf;
+static unsigned int maxreqbuf;
+
+/* Stop a worker and reap it.  One that is still there after
+ * WORKER_GRACE milliseconds of SIGTERM is killed.
+ */
+static void worker_stop(struct worker *w){
+	if (w->pid > 0) {
+		int i, r;
+
+		close(w->fd);
+		kill(w->pid, SIGTERM);
+		for (i = 0; (r = waitpid(w->pid, 0, WNOHANG)) == 0 && i < WORKER_GRACE; i++) {
+			usleep(1000);
+		}
+		if (r == 0) {
+			kill(w->pid, SIGKILL);
+			while (waitpid(w->pid, 0, 0) < 0 && errno == EINTR)
+				;
+		}
+	}
+	w->pid = 0;
+	w->busy = 0;
+}
+
+/* The worker has died, or broke the protocol.
+ */
+static void worker_lost(struct pool *p, struct worker *w){
+	status_printf("pool %s: worker %d lost\n", p->name, w->pid);
+	worker_stop(w);
+	p->restarts++;
+}
+
+static int worker_start(struct pool *p, struct worker *w){
+	int sv[2], script;
+	const char *file = path_lookup(p->argv[0], &script);
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0) {
+		perror("socketpair");
+		return -1;
+	}
+	readers_sync();
+	fflush(stdout);
+	fflush(stderr);
+	limit_spawn();
+	if ((w->pid = fork()) < 0) {
+		perror("fork");
+		close(sv[0]);
+		close(sv[1]);
+		w->pid = 0;
+		return -1;
+	}
+	if (w->pid == 0) {
+		interrupts_disable();
+		dup2(sv[1], 0);
+		dup2(sv[1], 1);
+		execv(file == 0 ? p->argv[0] : file, p->argv);
+		perror(p->argv[0]);
+		_exit(127);
+	}
+	close(sv[1]);
+	w->fd = sv[0];
+	w->busy = 0;
+	return 0;
+}
+
+/* Read exactly len bytes.  Returns -1 on EOF or error.
+ */
+static int read_full(int fd, void *buf, unsigned int len){
+	char *p = buf;
+
+	while (len > 0) {
+		int n = read(fd, p, len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/* Wait for the reply to the outstanding request of a worker.  Returns
+ * the exit status.
+ */
+static int worker_reply(struct pool *p, struct worker *w){
+	uint32_t len;
+	int32_t status;
+
+	if (read_full(w->fd, &len, sizeof(len)) < 0 || len != sizeof(status)
+							|| read_full(w->fd, &status, sizeof(status)) < 0) {
+		worker_lost(p, w);
+		return 1;
+	}
+	w->busy = 0;
+	if (w->background) {
+		status_printf("pool %s: worker %d finished with status %d\n", p->name, w->pid, status);
+	}
+	return status;
+}
+
+/* Collect the replies that have arrived for background requests.
+ */
+static void pool_collect(struct pool *p, int timeout){
+	struct pollfd pfds[MAX_WORKERS];
+	int i, n = 0;
+
+	for (i = 0; i < p->nworkers; i++) {
+		pfds[i].fd = p->workers[i].pid > 0 && p->workers[i].busy ? p->workers[i].fd : -1;
+		pfds[i].events = POLLIN;
+		n += pfds[i].fd >= 0;
+	}
+	if (n == 0 || poll(pfds, p->nworkers, timeout) <= 0) {
+		return;
+	}
+	for (i = 0; i < p->nworkers; i++) {
+		if (pfds[i].fd >= 0 && pfds[i].revents != 0) {
+			worker_reply(p, &p->workers[i]);
+		}
+	}
+}
+
+/* Find an idle worker, starting one if there is room, or else waiting
+ * for one to finish.
+ */
+static struct worker *pool_worker(struct pool *p){
+	int i;
+
+	for (;;) {
+		pool_collect(p, 0);
+		for (i = 0; i < p->nworkers; i++) {
+			if (p->workers[i].pid > 0 && !p->workers[i].busy) {
+				return &p->workers[i];
+			}
+		}
+		for (i = 0; i < p->nworkers; i++) {
+			if (p->workers[i].pid == 0) {
+				return worker_start(p, &p->workers[i]) < 0 ? 0 : &p->workers[i];
+			}
+		}
+		pool_collect(p, -1);
+	}
+}
+
+/* Send a request, with standard input, output and error.  Returns -1 if
+ * the worker is gone.
+ */
+static int worker_send(struct worker *w, const char *buf, unsigned int len){
+	int fds[3] = { 0, 1, 2 };
+	char control[CMSG_SPACE(sizeof(fds))];
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(control, 0, sizeof(control));
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	while (len > 0) {
+		int n = sendmsg(w->fd, &msg, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		iov.iov_base = (char *) iov.iov_base + n;
+		iov.iov_len = len -= n;
+		msg.msg_control = 0;			// the descriptors went with the first part
+		msg.msg_controllen = 0;
+	}
+	return 0;
+}
+
+/* Put a string in the request buffer at offset off.
+ */
+static unsigned int request_add(unsigned int off, const char *s){
+	unsigned int len = strlen(s) + 1;
+
+	if (off + len > maxreqbuf) {
+		while (off + len > maxreqbuf) {
+			maxreqbuf = maxreqbuf == 0 ? 4096 : maxreqbuf * 2;
+		}
+		reqbuf = mem_realloc(MEM_EXEC, reqbuf, maxreqbuf);
+	}
+	memcpy(reqbuf + off, s, len);
+	return off + len;
+}
+
+static struct pool *pool_find(const char *name){
+	struct pool *p;
+
+	for (p = pools; p != 0; p = p->next) {
+		if (strcmp(p->name, name) == 0) {
+			return p;
+		}
+	}
+	return 0;
+}
+
+int pool_run(command_t command, int background){
+	struct pool *p;
+	struct fdsave save;
+	char cwd[4096];
+	unsigned int len;
+	int i, attempt, status = 1;
+
+	if (command->argc < 4) {
+		fprintf(stderr, "Usage: @pool name command [argument ...]\n");
+		return 2;
+	}
+	if ((p = pool_find(command->argv[1])) == 0) {
+		fprintf(stderr, "@pool: %s: no such pool\n", command->argv[1]);
+		return 1;
+	}
+	if (getcwd(cwd, sizeof(cwd)) == 0) {
+		perror("getcwd");
+		return 1;
+	}
+
+	len = request_add(sizeof(uint32_t), cwd);
+	for (i = 2; command->argv[i] != 0; i++) {
+		len = request_add(len, command->argv[i]);
+	}
+	*(uint32_t *) reqbuf = len - sizeof(uint32_t);
+
+	/* Send it with the redirections applied to the shall, so that the
+	 * worker gets the files.  A worker that turns out to be dead before
+	 * it got the request is replaced, and the request sent again.
+	 */
+	if (redirect_push(command, &save) == 0) {
+		for (attempt = 0; attempt < 2; attempt++) {
+			struct worker *w = pool_worker(p);
+			if (w == 0) {
+				break;
+			}
+			if (worker_send(w, reqbuf, len) < 0) {
+				worker_lost(p, w);
+				continue;
+			}
+			p->requests++;
+			w->busy = 1;
+			w->background = background;
+			status = background ? 0 : worker_reply(p, w);
+			break;
+		}
+	}
+	redirect_pop(&save);
+	return status;
+}
+
+static void pool_free(struct pool *p){
+	int i;
+
+	for (i = 0; i < p->nworkers; i++) {
+		worker_stop(&p->workers[i]);
+	}
+	for (i = 0; p->argv[i] != 0; i++) {
+		mem_free(p->argv[i]);
+	}
+	mem_free(p->argv);
+	mem_free(p->name);
+	mem_free(p);
+}
+
+int pool(command_t command){
+	struct pool *p, **pp;
+	int i, n;
+
+	if (command->argc == 2) {
+		for (p = pools; p != 0; p = p->next) {
+			for (i = n = 0; i < p->nworkers; i++) {
+				n += p->workers[i].pid > 0;
+			}
+			printf("%s: %d of %d workers running, %lu requests, %lu restarts:",
+							p->name, n, p->nworkers, p->requests, p->restarts);
+			for (i = 0; p->argv[i] != 0; i++) {
+				printf(" %s", p->argv[i]);
+			}
+			printf("\n");
+		}
+		fflush(stdout);
+		return 0;
+	}
+	if (command->argc < 5 || (n = atoi(command->argv[2])) < 1 || n > MAX_WORKERS) {
+		fprintf(stderr, "Usage: pool [name workers command [argument ...]]\n");
+		return 2;
+	}
+
+	/* A new definition replaces the old one and its workers.
+	 */
+	for (pp = &pools; *pp != 0; pp = &(*pp)->next) {
+		if (strcmp((*pp)->name, command->argv[1]) == 0) {
+			p = *pp;
+			*pp = p->next;
+			pool_free(p);
+			break;
+		}
+	}
+	p = mem_calloc(MEM_EXEC, sizeof(*p));
+	p->name = mem_alloc(MEM_EXEC, strlen(command->argv[1]) + 1);
+	strcpy(p->name, command->argv[1]);
+	p->nworkers = n;
+	p->argv = mem_calloc(MEM_EXEC, (command->argc - 3) * sizeof(*p->argv));
+	for (i = 3; command->argv[i] != 0; i++) {
+		p->argv[i - 3] = mem_alloc(MEM_EXEC, strlen(command->argv[i]) + 1);
+		strcpy(p->argv[i - 3], command->argv[i]);
+	}
+	p->next = pools;
+	pools = p;
+	return 0;
+}
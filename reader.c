@@ -4,34 +4,295 @@
  *	reader_t reader_create(int fd);
  *		Create a reader that reads characters from the given file descriptor.
  *
+ *	reader_t reader_create_buffer(const char *buf, unsigned int len):
+ *		Create a reader that returns the len characters in buf, which
+ *		must stay around until the reader is freed.
+ *
+ *	reader_t reader_open(const char *file):
+ *		Create a reader for a script file.  Returns 0 after complaining
+ *		if the file cannot be opened.
+ *
  *	char reader_next(reader_t reader):
  *		Return the next character or -1 upon EOF (or error...)
  *
+ *	void readers_sync():
+ *		Give back whatever the readers have buffered but not returned
+ *		yet, so that a child process finds the file offsets where the
+ *		shall has logically stopped reading.
+ *
  *	void reader_free(reader_t reader):
  *		Release any memory allocated.
+ *
+ *	void reader_record(reader_t reader):
+ *		Pass the characters returned from now on to record_input().
+ *
+ *	void reader_interactive(reader_t reader):
+ *		The reader reads commands typed on a terminal.  Turns on
+ *		bracketed paste mode in the terminal.
+ *
+ *	void reader_prompt(reader_t reader, const char *prompt):
+ *		Display the prompt before the next read() that would wait for
+ *		input.
+ *
+ * Characters are read READER_BUFSIZE at a time.  Before a child is started
+ * the buffered characters are given back by moving the file offset back.
+ * That is not possible for pipes, so there the reader falls back to
+ * reading a character at a time, as the child may read from the same
+ * pipe.  Terminals return at most a line per read() anyway, and are
+ * always buffered.
+ *
+ * A reader of a buffer in memory, as for 'shall -c', makes no system
+ * calls at all.  A script file is read into memory whole, with a single
+ * read(), and closed: no child can see its file offset, so there is
+ * nothing to give back before a child starts either.  Only a script that
+ * is not a regular file is read through its file descriptor.
+ *
+ * A block of text pasted into a terminal would come in a line per read(),
+ * with a prompt written after each.  Instead, in bracketed paste mode the
+ * terminal sends ESC [200~ before the pasted text and ESC [201~ after it.
+ * The reader drops these, and in between turns off line mode in the
+ * terminal so that what has been pasted is read READER_TTYBUFSIZE at a
+ * time.  Prompts are only displayed when the reader is about to wait for
+ * input, which it does not while a paste lasts, or while more input is
+ * ready anyway.  So a paste gets one prompt, after it has been run.
  */
 
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <poll.h>
 #include <assert.h>
+#include <errno.h>
 #include "shall.h"
-#include <sys/errno.h>
+
+#define READER_BUFSIZE		8192
+#define READER_TTYBUFSIZE	65536
+#define PASTE_MARKLEN		6		// ESC [ 2 0 0 ~
+
+/* Settings of the terminal: as found, which is what commands run with, or
+ * in line mode but not echoing the paste markers, or out of line mode for
+ * a paste.
+ */
+#define TTY_ORIG	0
+#define TTY_LINE	1
+#define TTY_RAW		2
+
+static const char paste_start[] = "\033[200~", paste_end[] = "\033[201~";
+
 struct reader {
-	int fd;
+	int fd;					// -1 if reading from memory only
+	int ownfd;				// opened by reader_open(), to be closed
+	int borrowed;			// buf belongs to the caller
+	int exact;				// read one character at a time
+	int record;				// characters are recorded
+	int tty;				// reads commands from a terminal
+	int paste;				// between the paste markers
+	int mode;				// TTY_* settings of the terminal
+	struct termios orig;	// settings the terminal had
+	const char *prompt;		// to display before waiting for input
+	char *buf;
+	unsigned int size;		// of buf
+	unsigned int pos, len;	// next character and end of the data in buf
+	reader_t next;			// list of all readers
 };
+
+static reader_t readers;	// all readers, so they can be synced
+static int ttyowner;		// process that set up the terminal, not its children
+
 // struct reader z,*p
 // z.fd equals (*p).zf equals p->zf;//read the int fd in the struct
 reader_t reader_create(int fd){                                 //must be with a *, which what reader points to//if without *, it would just be a 8byte reader
-	reader_t reader = (reader_t) calloc(1, sizeof(*reader));//allocate size to the reader,allocate 8bytes,multiply these 
+	reader_t reader = (reader_t) mem_calloc(MEM_READER, sizeof(*reader));//allocate size to the reader,allocate 8bytes,multiply these
 	reader->fd = fd;//difference betweenn malloca,calloc: calloc set the variable to 0,cleaner; malloc
+	reader->exact = lseek(fd, 0, SEEK_CUR) < 0 && !isatty(fd);
+	if (!reader->exact) {
+		reader->size = READER_BUFSIZE;
+		reader->buf = mem_alloc(MEM_READER, reader->size);
+	}
+	reader->next = readers;
+	readers = reader;
+	return reader;
+}
+
+reader_t reader_create_buffer(const char *buf, unsigned int len){
+	reader_t reader = (reader_t) mem_calloc(MEM_READER, sizeof(*reader));
+
+	reader->fd = -1;
+	reader->borrowed = 1;
+	reader->buf = (char *) buf;
+	reader->size = reader->len = len;
+	reader->next = readers;
+	readers = reader;
 	return reader;
 }
+
+reader_t reader_open(const char *file){
+	struct stat st;
+	reader_t reader;
+	int fd = open(file, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		perror(file);
+		return 0;
+	}
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		reader = reader_create(fd);
+		reader->ownfd = 1;
+		return reader;
+	}
+
+	/* Read it whole.  A file that grows meanwhile is read up to the
+	 * size it had.
+	 */
+	char *buf = mem_alloc(MEM_READER, st.st_size + 1);
+	unsigned int len = 0;
+	while (len < st.st_size) {
+		int n = read(fd, buf + len, st.st_size - len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n < 0) {
+			perror(file);
+		}
+		if (n <= 0) {
+			break;
+		}
+		len += n;
+	}
+	close(fd);
+	reader = reader_create_buffer(buf, len);
+	reader->borrowed = 0;
+	return reader;
+}
+
+/* Change the settings of the terminal.
+ */
+static void reader_mode(reader_t reader, int mode){
+	struct termios t = reader->orig;
+
+	if (!reader->tty || mode == reader->mode) {
+		return;
+	}
+	if (mode != TTY_ORIG) {
+		t.c_lflag &= ~ECHOCTL;
+	}
+	if (mode == TTY_RAW) {
+		t.c_lflag &= ~ICANON;
+		t.c_cc[VMIN] = 1;
+		t.c_cc[VTIME] = 0;
+	}
+	tcsetattr(reader->fd, TCSANOW, &t);
+	reader->mode = mode;
+}
+
+/* Drop the paste markers from the data in the buffer, and keep track of
+ * whether a paste is going on.
+ */
+static void reader_unpaste(reader_t reader){
+	char *p = reader->buf, *end = reader->buf + reader->len;
+
+	while ((p = memchr(p, '\033', end - p)) != 0) {
+		if (end - p >= PASTE_MARKLEN && memcmp(p, paste_start, PASTE_MARKLEN) == 0) {
+			reader->paste = 1;
+		}
+		else if (end - p >= PASTE_MARKLEN && memcmp(p, paste_end, PASTE_MARKLEN) == 0) {
+			reader->paste = 0;
+		}
+		else {
+			p++;
+			continue;
+		}
+		memmove(p, p + PASTE_MARKLEN, end - p - PASTE_MARKLEN);
+		end -= PASTE_MARKLEN;
+	}
+	reader->len = end - reader->buf;
+	reader_mode(reader, reader->paste ? TTY_RAW : TTY_LINE);
+}
+
+/* Return the length of the start of a paste marker at the end of the
+ * data in the buffer, which the rest of the marker should follow.
+ */
+static int reader_partial(reader_t reader){
+	int n;
+
+	for (n = PASTE_MARKLEN - 1; n > 0; n--) {
+		if (reader->len >= n) {
+			const char *tail = reader->buf + reader->len - n;
+			if (memcmp(tail, paste_start, n) == 0 || memcmp(tail, paste_end, n) == 0) {
+				return n;
+			}
+		}
+	}
+	return 0;
+}
+
+/* Display the prompt unless input is ready or a paste is going on.
+ */
+static void reader_display_prompt(reader_t reader){
+	struct pollfd pfd;
+
+	if (reader->prompt != 0 && !reader->paste) {
+		pfd.fd = reader->fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 0) <= 0) {
+			fputs(reader->prompt, stderr);
+		}
+	}
+	reader->prompt = 0;
+}
+
+/* Read more characters into the buffer.  Returns 0 on EOF or error.
+ */
+static int reader_fill(reader_t reader){
+	reader->pos = reader->len = 0;
+	if (reader->tty) {
+		reader_display_prompt(reader);
+		reader_mode(reader, reader->paste ? TTY_RAW : TTY_LINE);
+	}
+	for (;;) {
+		int n = read(reader->fd, reader->buf + reader->len, reader->size - reader->len);
+		if (n > 0) {
+			reader->len += n;
+			if (!reader->tty) {
+				return 1;
+			}
+			if (reader_partial(reader) > 0 && reader->len + PASTE_MARKLEN <= reader->size) {
+				continue;		// a marker split over two reads
+			}
+			reader_unpaste(reader);
+			if (reader->len > 0) {
+				return 1;
+			}
+			continue;
+		}
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (reader->len > 0) {		// half a marker before EOF
+			return 1;
+		}
+		return 0;
+	}
+}
+
 //reader->token->parser->elements->shall
-char reader_next(reader_t reader){//return the next chracter
+static char reader_get(reader_t reader){//return the next chracter
+	if (reader->pos < reader->len) {
+		return reader->buf[reader->pos++];
+	}
+	if (reader->fd < 0) {
+		return EOF;
+	}
+	if (!reader->exact) {
+		return reader_fill(reader) ? reader->buf[reader->pos++] : EOF;
+	}
+
     char c;
     for (;;) {
-        extern int errno;
         int n = read(reader->fd, &c, 1);//read the file(could be keyboard)//system call, takes fd, pointer to charc c//-1:error, 0:
         if (n > 0) {//& takes the object, return the poitner,equals **//* take the pointer, return the object. //int *p
             return c;//number of charcters
@@ -42,8 +303,100 @@ char reader_next(reader_t reader){//return the next chracter
     }
 }
 
-//homework:use a buffer, use less system call: after buffer is clean, call system call
+char reader_next(reader_t reader){
+	char c = reader_get(reader);
+
+	if (reader->record && c != EOF) {
+		record_input(c);
+	}
+	return c;
+}
+
+void reader_record(reader_t reader){
+	reader->record = 1;
+}
+
+/* Leave the terminal as it was found.
+ */
+static void reader_tty_reset(reader_t reader){
+	if (reader->tty) {
+		reader_mode(reader, TTY_ORIG);
+		write(STDERR_FILENO, "\033[?2004l", 8);
+		reader->tty = 0;
+	}
+}
+
+static void readers_tty_reset(){
+	reader_t reader;
+
+	if (getpid() != ttyowner) {
+		return;
+	}
+	for (reader = readers; reader != 0; reader = reader->next) {
+		reader_tty_reset(reader);
+	}
+}
+
+void reader_interactive(reader_t reader){
+	static int registered;
+
+	if (reader->exact || !isatty(STDERR_FILENO) || tcgetattr(reader->fd, &reader->orig) < 0) {
+		return;
+	}
+	reader->tty = 1;
+	reader->mode = TTY_ORIG;
+	reader->size = READER_TTYBUFSIZE;
+	reader->buf = mem_realloc(MEM_READER, reader->buf, reader->size);
+	write(STDERR_FILENO, "\033[?2004h", 8);
+	ttyowner = getpid();
+	if (!registered) {
+		atexit(readers_tty_reset);
+		registered = 1;
+	}
+}
+
+void reader_prompt(reader_t reader, const char *prompt){
+	if (reader->tty) {
+		reader->prompt = prompt;
+	}
+	else {
+		fputs(prompt, stderr);
+	}
+}
+
+/* Move the file offset back over the characters that were read but
+ * not returned yet, and drop them from the buffer.
+ */
+static void reader_sync(reader_t reader){
+	reader_mode(reader, TTY_ORIG);		// for a command reading the terminal
+	if (reader->fd >= 0 && reader->pos < reader->len) {
+		if (lseek(reader->fd, (off_t) reader->pos - reader->len, SEEK_CUR) >= 0) {
+			reader->pos = reader->len = 0;
+		}
+	}
+}
+
+void readers_sync(){
+	reader_t reader;
+
+	for (reader = readers; reader != 0; reader = reader->next) {
+		reader_sync(reader);
+	}
+}
 
 void reader_free(reader_t reader){
-	free(reader);
+	reader_t *pr;
+
+	reader_sync(reader);
+	for (pr = &readers; *pr != reader; pr = &(*pr)->next)
+		;
+	*pr = reader->next;
+	reader_tty_reset(reader);
+	if (reader->ownfd) {
+		close(reader->fd);
+	}
+	if (!reader->borrowed) {
+		mem_free(reader->buf);
+	}
+	mem_free(reader);
 }
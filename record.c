@@ -0,0 +1,300 @@
+/* Recording a session, and replaying it as a benchmark.
+ *
+ * 'shall -R log' runs as usual, but writes to 'log' the input that the
+ * shall reads, with the time at which it was read, and for every
+ * external command when it started, how long it ran and its exit
+ * status.  'shall -P log' reads the same input from the log and runs it
+ * again, but every external command is replaced by a child process that
+ * sleeps for the recorded time and exits with the recorded status.  What
+ * remains is the time the shall itself takes on a realistic workload,
+ * which is reported at the end.
+ *
+ * The log is text, one event per line, with times in microseconds since
+ * the start of the session:
+ *
+ *	i <time> <length>		followed by that many bytes of input and a newline
+ *	c <number> <start> <duration> <status> <name>
+ *
+ * Commands are numbered in the order in which they were started.  Their
+ * lines are written when they terminate, so background commands may be
+ * out of order.  During replay the commands are matched up by number.
+ *
+ * The interface is as follows:
+ *	int record_open(const char *file):
+ *		Start recording to the given file.  Returns -1 on error.
+ *
+ *	void record_input(char c):
+ *		Record a character of input.
+ *
+ *	void record_spawn(int pid, const char *name):
+ *		Record that an external command was started.
+ *
+ *	void record_reap(int pid, int status):
+ *		Record that a process has terminated with the given status.
+ *
+ *	int replay_open(const char *file):
+ *		Start replaying the given log.  Returns a file descriptor from
+ *		which the recorded input can be read, or -1 on error.
+ *
+ *	long replay_command(const char *name, int background, int *status):
+ *		If replaying, return the number of microseconds the next external
+ *		command should take, and set *status to its exit status.
+ *		Otherwise return -1.
+ */
+
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include "shall.h"
+
+#define RECORD_BUFSIZE	65536
+#define RECORD_GAP		1000		// input read within 1ms is one event
+
+static int recfd = -1;				// the log being written
+static int recowner;				// process that writes it, not its children
+static struct timespec start;		// start of the session
+static char recbuf[RECORD_BUFSIZE];
+static unsigned int reclen;
+
+/* Input that has not been written yet.
+ */
+static char *input;
+static unsigned int ninput, maxinput;
+static long inputtime;
+
+/* External commands that are running.
+ */
+static struct running {
+	int pid;
+	unsigned int number;
+	long start;
+	char name[32];
+} *running;
+static unsigned int nrunning, maxrunning, ncommands;
+
+/* The commands of the log being replayed, by number.
+ */
+static struct replay {
+	long duration;
+	int status;
+} *replays;
+static unsigned int nreplays, nextreplay;
+static long replaytime;				// total duration of foreground commands
+
+static long record_now(){
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec - start.tv_sec) * 1000000L + (ts.tv_nsec - start.tv_nsec) / 1000;
+}
+
+static void record_flush(){
+	unsigned int off = 0;
+
+	if (getpid() == recowner) {
+		while (off < reclen) {
+			int n = write(recfd, recbuf + off, reclen - off);
+			if (n <= 0) {
+				break;
+			}
+			off += n;
+		}
+	}
+	reclen = 0;
+}
+
+static void record_write(const char *s, unsigned int len){
+	while (len > 0) {
+		unsigned int n = RECORD_BUFSIZE - reclen;
+		if (n > len) {
+			n = len;
+		}
+		memcpy(recbuf + reclen, s, n);
+		reclen += n;
+		s += n;
+		len -= n;
+		if (reclen == RECORD_BUFSIZE) {
+			record_flush();
+		}
+	}
+}
+
+/* Write the input collected so far as one event.
+ */
+static void record_input_flush(){
+	char line[64];
+
+	if (ninput > 0) {
+		record_write(line, snprintf(line, sizeof(line), "i %ld %u\n", inputtime, ninput));
+		record_write(input, ninput);
+		record_write("\n", 1);
+		ninput = 0;
+	}
+}
+
+static void record_close(){
+	if (recfd >= 0) {
+		record_input_flush();
+		record_flush();
+		if (getpid() == recowner) {
+			close(recfd);
+		}
+		recfd = -1;
+	}
+	if (replays != 0 && getpid() == recowner) {
+		long total = record_now();
+		fprintf(stderr, "replay: %u commands, %.3f s in commands, %.3f s in the shall\n",
+					nextreplay, replaytime / 1e6, (total - replaytime) / 1e6);
+	}
+}
+
+int record_open(const char *file){
+	if ((recfd = open(file, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) < 0) {
+		perror(file);
+		return -1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	recowner = getpid();
+	atexit(record_close);
+	return 0;
+}
+
+void record_input(char c){
+	if (recfd < 0) {
+		return;
+	}
+	if (ninput > 0 && record_now() - inputtime > RECORD_GAP) {
+		record_input_flush();
+	}
+	if (ninput == 0) {
+		inputtime = record_now();
+	}
+	if (ninput == maxinput) {
+		maxinput = maxinput == 0 ? 256 : maxinput * 2;
+		input = mem_realloc(MEM_RECORD, input, maxinput);
+	}
+	input[ninput++] = c;
+}
+
+void record_spawn(int pid, const char *name){
+	unsigned int i;
+
+	if (recfd < 0) {
+		return;
+	}
+	if (nrunning == maxrunning) {
+		maxrunning = maxrunning == 0 ? 16 : maxrunning * 2;
+		running = mem_realloc(MEM_RECORD, running, maxrunning * sizeof(*running));
+	}
+	struct running *r = &running[nrunning++];
+	r->pid = pid;
+	r->number = ncommands++;
+	r->start = record_now();
+
+	/* The name is only for people reading the log; keep it one word.
+	 */
+	for (i = 0; i < sizeof(r->name) - 1 && name[i] != 0; i++) {
+		r->name[i] = name[i] > ' ' && name[i] < 127 ? name[i] : '?';
+	}
+	r->name[i] = 0;
+}
+
+void record_reap(int pid, int status){
+	unsigned int i;
+	char line[128];
+
+	if (recfd < 0) {
+		return;
+	}
+	for (i = 0; i < nrunning; i++) {
+		if (running[i].pid == pid) {
+			struct running *r = &running[i];
+			record_input_flush();
+			record_write(line, snprintf(line, sizeof(line), "c %u %ld %ld %d %s\n",
+					r->number, r->start, record_now() - r->start, status, r->name));
+			running[i] = running[--nrunning];
+			return;
+		}
+	}
+}
+
+int replay_open(const char *file){
+	FILE *fp = fopen(file, "re");
+	char line[256];
+	int fd;
+
+	if (fp == 0) {
+		perror(file);
+		return -1;
+	}
+	if ((fd = memfd_create("replay", MFD_CLOEXEC)) < 0) {
+		perror("memfd_create");
+		fclose(fp);
+		return -1;
+	}
+
+	/* Collect the input in a memory file, and the commands in an array.
+	 */
+	while (fgets(line, sizeof(line), fp) != 0) {
+		long time, duration;
+		unsigned int len, number;
+		int status;
+
+		if (sscanf(line, "i %ld %u", &time, &len) == 2) {
+			char buf[4096];
+			while (len > 0) {
+				unsigned int n = len < sizeof(buf) ? len : sizeof(buf);
+				if (fread(buf, 1, n, fp) != n || write(fd, buf, n) != n) {
+					break;
+				}
+				len -= n;
+			}
+			getc(fp);		// the newline after the input
+		}
+		else if (sscanf(line, "c %u %ld %ld %d", &number, &time, &duration, &status) == 4) {
+			if (number >= nreplays) {
+				replays = mem_realloc(MEM_RECORD, replays, (number + 1) * sizeof(*replays));
+				memset(&replays[nreplays], 0, (number + 1 - nreplays) * sizeof(*replays));
+				nreplays = number + 1;
+			}
+			replays[number].duration = duration;
+			replays[number].status = status;
+		}
+		else {
+			fprintf(stderr, "%s: bad line: %s", file, line);
+		}
+	}
+	fclose(fp);
+	if (replays == 0) {
+		replays = mem_calloc(MEM_RECORD, sizeof(*replays));
+	}
+	lseek(fd, 0, SEEK_SET);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	recowner = getpid();
+	atexit(record_close);
+	return fd;
+}
+
+long replay_command(const char *name, int background, int *status){
+	if (replays == 0) {
+		return -1;
+	}
+	if (nextreplay >= nreplays) {
+		if (nextreplay++ == nreplays) {
+			fprintf(stderr, "replay: more commands than recorded, from %s on\n", name);
+		}
+		*status = 0;
+		return 0;
+	}
+	struct replay *r = &replays[nextreplay++];
+	*status = r->status;
+	if (!background) {
+		replaytime += r->duration;
+	}
+	return r->duration;
+}
@@ -15,100 +15,116 @@
 #include <unistd.h>//system calls!
 #include <signal.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <string.h>
 #include <assert.h>//while testing,easier to understand
 #include "shall.h"
 
-static void arg_append(command_t command, char *arg){
-	command->argv = realloc(command->argv, (command->argc + 1) * sizeof(*command->argv));
-	command->argv[command->argc++] = arg;
-}
-
-static void redir_append(command_t command, element_t elt){
-	command->redirs = realloc(command->redirs,
-				(command->nredirs + 1) * sizeof(command->redirs));
-	command->redirs[command->nredirs++] = elt;
-}
-
-/* Display the next prompt.
+/* Display the next prompt.  The reader displays it when it has to wait
+ * for input, so that lines already typed or pasted do not get one each.
  */
-static void display_prompt(){
-	fprintf(stderr, "-> ");
+static void display_prompt(reader_t reader){
+	reader_prompt(reader, "-> ");
 }
 
-static void gotline(command_t command, int background){
+/* Hand a complete command to the block.  *pipein is the fd of the pipe
+ * that the command reads from, or 0.  A pipe at the end of a line
+ * continues on the next line.
+ */
+static void gotline(block_t block, command_t command, int background, int *pipein){
 	if (command->argc > 0) {
-		arg_append(command, 0);
-		perform(command, background);
+		command->pipein = *pipein;
+		*pipein = 0;
+		command_finish(command);
+		block_command(block, command, background);
 	}
+	command_clear(command);
+}
 
-	int i;
-	for (i = 0; i < command->argc; i++) {
-		free(command->argv[i]);
-	}
-	command->argc = 0;
-	for (i = 0; i < command->nredirs; i++) {
-		element_free(command->redirs[i]);
+/* Drop the part of a pipeline that has been read.
+ */
+static void pipe_cancel(block_t block, int *pipein, const char *msg){
+	if (msg != 0) {
+		fprintf(stderr, "%s\n", msg);
 	}
-	command->nredirs = 0;
+	block_pipe_cancel(block);
+	*pipein = 0;
 }
 
 void interpret(reader_t reader, int interactive){
 	struct command command;
+	int pipein = 0;
 
 	memset(&command, 0, sizeof(command));
 
 	tokenizer_t tokenizer = tokenizer_create(reader);
 	parser_t parser = parser_create(tokenizer);
+	block_t block = block_create();
 
 	if (interactive) {
-		display_prompt();
+		reader_interactive(reader);
+		display_prompt(reader);
 	}
 
 
 	int more = 1;
 	while (more) {
-		element_t elt = parser_next(parser);
-		switch (elt->type) {
+		struct element elt;
+
+		status_flush();
+		parser_next(parser, &elt);
+		switch (elt.type) {
 		case ELEMENT_ARG:
-			arg_append(&command, elt->u.arg.string);
-			elt->u.arg.string = 0;
-			element_free(elt);
+			command_arg(&command, sstring_get(&elt.string), elt.string.len);
+			element_release(&elt);
 			break;
 		case ELEMENT_REDIR_FILE_IN:
 		case ELEMENT_REDIR_FILE_OUT:
 		case ELEMENT_REDIR_FILE_APPEND:
 		case ELEMENT_REDIR_FD_IN:
 		case ELEMENT_REDIR_FD_OUT:
-			redir_append(&command, elt);
+		case ELEMENT_REDIR_CLOSE:
+			command_redir(&command, &elt);
+			element_release(&elt);
+			break;
+		case ELEMENT_PIPE:
+			if (command.argc == 0) {
+				pipe_cancel(block, &pipein, "missing command before '|'");
+				break;
+			}
+			command.pipemore = 1;
+			gotline(block, &command, 0, &pipein);
+			pipein = elt.fd1;
 			break;
 		case ELEMENT_EOLN:
-			element_free(elt);
-			gotline(&command, 0);
+			gotline(block, &command, 0, &pipein);
 			if (interactive) {
-				display_prompt();
+				display_prompt(reader);
 			}
 			break;
 		case ELEMENT_SEMI:
-			element_free(elt);
-			gotline(&command, 0);
-			break;
 		case ELEMENT_BACKGROUND:
-			element_free(elt);
-			gotline(&command, 1);
+			if (pipein != 0 && command.argc == 0) {
+				pipe_cancel(block, &pipein, "missing command after '|'");
+			}
+			gotline(block, &command, elt.type != ELEMENT_BACKGROUND ? 0 :
+					elt.string.len > 0 ? jobs_group(sstring_get(&elt.string)) : 1, &pipein);
+			element_release(&elt);
 			break;
 		case ELEMENT_ERROR:
-			element_free(elt);
+			pipe_cancel(block, &pipein, 0);
 			if (interactive) {
-				display_prompt();
+				display_prompt(reader);
 			}
 			break;
 		case ELEMENT_EOF:
-			element_free(elt);
 			if (interactive) {
 				fprintf(stderr, "EOF\n");
 			}
-			gotline(&command, 0);
+			if (pipein != 0 && command.argc == 0) {
+				pipe_cancel(block, &pipein, "missing command after '|'");
+			}
+			gotline(block, &command, 0, &pipein);
 			more = 0;
 			break;
 		default:
@@ -116,10 +132,62 @@ void interpret(reader_t reader, int interactive){
 		}
 	}
 
+	block_free(block);
 	parser_free(parser);
 	tokenizer_free(tokenizer);
-	free(command.argv);
-	free(command.redirs);
+	command_free(&command);
+}
+
+/* Set $1 through $9 from argv[1] on.
+ */
+static void set_params(char **argv){
+	char name[2] = { 0, 0 };
+	int i;
+
+	for (i = 1; i < 10 && argv[i] != 0; i++) {
+		name[0] = '0' + i;
+		var_set(name, argv[i]);
+	}
+}
+
+/* Run the shall script in the given file, with $0 set to its name and
+ * $1 through $9 from argv[1] on.  Returns the exit status of the last
+ * command.
+ */
+int interpret_file(const char *file, char **argv){
+	var_set("0", file);
+	set_params(argv);
+	reader_t reader = reader_open(file);
+	if (reader == 0) {
+		return 127;
+	}
+	interpret(reader, 0);
+	reader_free(reader);
+	return last_status;
+}
+
+/* Run a plan compiled by shallc, with $0 set to argv[0] and $1 through
+ * $9 from argv[1] on.  Returns the exit status of the last command.
+ */
+static int interpret_plan(char *plan, unsigned int len, char **argv){
+	var_set("0", argv[0]);
+	set_params(argv);
+	decode_buffer(plan, len, INPUT_PLAN);
+	mem_free(plan);
+	return last_status;
+}
+
+/* Run the commands in the string, for 'shall -c commands', with $0 set
+ * to argv[0] and $1 through $9 from argv[1] on.  Returns the exit
+ * status of the last command.
+ */
+static int interpret_string(const char *commands, char **argv){
+	var_set("0", argv[0]);
+	set_params(argv);
+	reader_t reader = reader_create_buffer(commands, strlen(commands));
+	interpret(reader, 0);
+	reader_free(reader);
+	return last_status;
 }
 
 /* Main code.  If interactive, print prompts.  Read pipelines from input
@@ -140,9 +208,132 @@ void interpret(reader_t reader, int interactive){
 
 
 int main(int argc, char **argv){
+	static const struct option longopts[] = {
+		{ "input-format", required_argument, 0, 'F' },
+		{ 0, 0, 0, 0 }
+	};
+	int c, check = 0, input = 0, recording = 0, format = INPUT_TEXT;
+	const char *statusfile = 0, *commands = 0, *name = strrchr(argv[0], '/');
+	unsigned int planlen;
+	char *plan;
+
+	fds_init();
+	if (strcmp(name == 0 ? argv[0] : name + 1, "shallc") == 0) {
+		return shallc(argc, argv);
+	}
+	if ((plan = plan_load(&planlen)) != 0) {
+		status_open(0);
+		interrupts_catch();
+		int status = interpret_plan(plan, planlen, argv);
+		fdreaders_free();
+		return status;
+	}
+
+	/* Options end at the script or the name after -c: what follows
+	 * belongs to the script.
+	 */
+	while ((c = getopt_long(argc, argv, "+mnquB:L:R:P:S:c:", longopts, 0)) != -1) {
+		switch (c) {
+		case 'F':
+			if ((format = decode_format(optarg)) < 0) {
+				fprintf(stderr, "%s: --input-format=text|nul|binary\n", argv[0]);
+				return 1;
+			}
+			break;
+		case 'c':
+			commands = optarg;
+			break;
+		case 'm':
+			mem_enable();
+			break;
+		case 'n':
+			check = 1;
+			break;
+		case 'B':
+			if (buf_setmax(optarg) < 0) {
+				fprintf(stderr, "%s: -B size[k|m|g]\n", argv[0]);
+				return 1;
+			}
+			break;
+		case 'L':
+			if (limit_parse(optarg) < 0) {
+				fprintf(stderr, "%s: -L rate[:burst]\n", argv[0]);
+				return 1;
+			}
+			break;
+		case 'q':
+			statusfile = "";
+			break;
+		case 'S':
+			statusfile = optarg;
+			break;
+		case 'R':
+			if (record_open(optarg) < 0) {
+				return 1;
+			}
+			recording = 1;
+			break;
+		case 'P':
+			if ((input = replay_open(optarg)) < 0) {
+				return 1;
+			}
+			break;
+		case 'u':
+			textutil_enable(1);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-mnqu] [-B size] [-L rate[:burst]] [-S file] [-R log | -P log] [--input-format=format] [-c commands [name [argument ...]] | script [argument ...]]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (check) {
+		int fd = optind < argc ? open(argv[optind], O_RDONLY | O_CLOEXEC) : 0;
+		if (fd < 0) {
+			perror(argv[optind]);
+			return 2;
+		}
+		return check_script(fd);
+	}
+
+	if (status_open(statusfile) < 0) {
+		return 1;
+	}
 	interrupts_catch();
+	if (format != INPUT_TEXT) {
+		int fd = optind < argc ? open(argv[optind], O_RDONLY | O_CLOEXEC) : 0;
+		if (fd < 0) {
+			perror(argv[optind]);
+			return 127;
+		}
+		decode(fd, format);
+		fdreaders_free();
+		mem_leaks();
+		return last_status;
+	}
+	if (commands != 0) {
+		int status = interpret_string(commands, optind < argc ? &argv[optind] : argv);
+		fdreaders_free();
+		mem_leaks();
+		return status;
+	}
+	if (optind < argc) {
+		int status = interpret_file(argv[optind], &argv[optind]);
+		fdreaders_free();
+		mem_leaks();
+		return status;
+	}
+	if (input > 0) {		// replaying: the recorded input becomes stdin
+		dup2(input, 0);
+		close(input);
+	}
 	reader_t reader = reader_create(0);//allocate the resources of the reader
+	if (recording) {
+		reader_record(reader);
+	}
 	interpret(reader, isatty(0));
 	reader_free(reader);//release reader
+	fdreaders_free();
+	mem_leaks();
 	return 0;
 }
@@ -8,6 +8,32 @@ typedef struct parser *parser_t;
 typedef struct reader *reader_t;//reader t is a new type, is a pointer to a struct reader
 typedef struct command *command_t;
 
+/* Strings with a small-string optimization: strings shorter than
+ * SSTRING_INLINE bytes are kept in the structure itself, so that the
+ * common case of a short argument or file name does not need the heap.
+ */
+#define SSTRING_INLINE	24
+
+struct sstring {
+	unsigned int len;		// not including the terminating null character
+	union {
+		char buf[SSTRING_INLINE];
+		char *ptr;
+	} u;
+};
+
+#define sstring_get(s)	((s)->len < SSTRING_INLINE ? (s)->u.buf : (s)->u.ptr)
+
+/* Expansions are marked in string tokens with control characters, and
+ * are performed when the command is executed.
+ */
+#define CTL_ESC		'\001'		// the next character is literal
+#define CTL_VAR		'\002'		// $name: the name follows, up to CTL_END
+#define CTL_END		'\003'
+#define CTL_ARITH	'\004'		// $((expr)): the expression follows, up to CTL_END
+#define CTL_PARAM	'\005'		// ${...}: the text follows, up to the matching CTL_END
+#define CTL_MAX		'\007'		// characters up to here are escaped
+
 /* Tokens produced by the tokenizer.
  */
 struct token {
@@ -17,17 +43,18 @@ struct token {
 		TOKEN_EOLN,					// \n
 		TOKEN_STRING,				// a sequence of non-special chars
 		TOKEN_AMPERSAND,			// &
+		TOKEN_PIPE,					// |
 		TOKEN_GT,					// >
 		TOKEN_LT,					// <
 		TOKEN_CB_OPEN,				// {
 		TOKEN_CB_CLOSE				// }
 	} type;
-	union {
-		char *string;
-	} u;
+	struct sstring string;			// TOKEN_STRING only
+	int glued;						// TOKEN_STRING: no space before it
 };
 
-/* A command is a list of elements.
+/* A command is a list of elements.  Elements are small enough to be
+ * passed around by value.
  */
 struct element {
 	enum element_type {
@@ -37,55 +64,213 @@ struct element {
 		ELEMENT_REDIR_FILE_APPEND,			// >> file
 		ELEMENT_REDIR_FD_IN,				// < { fd }
 		ELEMENT_REDIR_FD_OUT,				// > { fd }
+		ELEMENT_REDIR_CLOSE,				// >&-
 		ELEMENT_SEMI,						// ;
 		ELEMENT_BACKGROUND,					// &
+		ELEMENT_PIPE,						// | or { fd } |
 		ELEMENT_EOLN,						// newline
 		ELEMENT_ERROR,
 		ELEMENT_EOF
 	} type;//type is one of above
-	union {//think this as a struct, decided by the type
-		struct {
-			char *string;
-		} arg;
-		struct {
-			int fd;
-			char *name;
-		} redir_file;
-		struct {
-			int fd1, fd2;
-		} redir_fd;
-	} u;
+	int fd1, fd2;					// redirections: fd1 becomes a copy of fd2
+									// pipes: fd1 is piped into the next command
+	struct sstring string;			// argument, or file name of a redirection,
+									// or group of a background command
+};
+
+/* Redirections of a command are packed into fixed-size records.  For file
+ * redirections the target is the offset of the file name in the string
+ * arena of the command, for fd redirections it is the fd to copy.
+ */
+struct redir {
+	int fd;
+	unsigned int target;
+	unsigned char type;				// one of the ELEMENT_REDIR_* types
 };
 
 /* Contains the specifics of a command.  Normal arguments and redirection
- * elements have been split into separate lists.
+ * elements have been split into separate lists.  The storage is kept
+ * when the command is cleared, so that reading a script does not need
+ * any allocation per command once the arrays have grown large enough.
  */
 struct command {
-	/* Arguments are collected here.
+	/* Arguments are collected here.  They point into the string arena.
 	 */
 	char **argv;
 	int argc;		// warning: includes the 0 pointer at the end of argv
+	int maxargv;
 
 	/* Redirections are collected here.
 	 */
-	element_t *redirs;
-	int nredirs;
+	struct redir *redirs;
+	int nredirs, maxredirs;
+
+	/* String arena holding the null-terminated arguments and file names
+	 * back to back.
+	 */
+	char *strings;
+	unsigned int nstrings, maxstrings;
+
+	int expand;		// some string contains an expansion
+
+	/* Pipelines: the command reads on its standard input what fd pipein
+	 * (1 for '|', N for '{N}|') of an earlier command writes, and
+	 * pipemore is set if a pipe follows the command.
+	 */
+	int pipein, pipemore;
 };
 
+/* File descriptors of the shall replaced by redirect_push().
+ */
+struct fdsave {
+	int n;
+	int userfd, raised;		// userfd before and after redirect_push()
+	struct {
+		int fd, copy;		// copy is -1 if fd was not open
+	} *fds;
+};
+
+/* Commands collected for a while loop, and the state of the parsing
+ * of loops, are kept in a block.
+ */
+typedef struct block *block_t;
+
+#define redir_name(command, r)	((command)->strings + (r)->target)
+
+/* Formats of the input (see decode.c).
+ */
+enum input_format { INPUT_TEXT, INPUT_NUL, INPUT_BINARY, INPUT_PLAN };
+
+/* Memory allocation with accounting per subsystem (see mem.c).  Unless
+ * accounting was enabled with 'shall -m', these are the plain C library
+ * functions.
+ */
+enum mem_subsys {
+	MEM_READER, MEM_TOKEN, MEM_PARSER, MEM_COMMAND, MEM_SHALL, MEM_EXEC, MEM_VAR,
+	MEM_EXPAND, MEM_RECORD,
+	MEM_NSUBSYS
+};
+extern int mem_enabled;
+void *mem_alloc_counted(enum mem_subsys subsys, size_t size, int zero);
+void *mem_realloc_counted(enum mem_subsys subsys, void *p, size_t size);
+void mem_free_counted(void *p);
+
+#define mem_alloc(subsys, size)		\
+	(mem_enabled ? mem_alloc_counted(subsys, size, 0) : malloc(size))
+#define mem_calloc(subsys, size)	\
+	(mem_enabled ? mem_alloc_counted(subsys, size, 1) : calloc(1, size))
+#define mem_realloc(subsys, p, size)	\
+	(mem_enabled ? mem_realloc_counted(subsys, p, size) : realloc(p, size))
+#define mem_free(p)		(mem_enabled ? mem_free_counted(p) : free(p))
+
+/* The 'background' argument of a command is 0 in the foreground and 1 in
+ * the background; from JOBS_GROUP on it names a group of jobs (jobs.c).
+ */
+#define JOBS_GROUP	2
+
 tokenizer_t tokenizer_create(reader_t reader);
-token_t tokenizer_next(tokenizer_t);
-void token_free(token_t);
+void tokenizer_next(tokenizer_t, token_t token);
+void token_release(token_t);
+void sstring_free(struct sstring *s);
 reader_t reader_create(int fd);
+reader_t reader_create_buffer(const char *buf, unsigned int len);
+reader_t reader_open(const char *file);
 char reader_next(reader_t reader);
+void readers_sync();
+void reader_record(reader_t reader);
+void reader_interactive(reader_t reader);
+void reader_prompt(reader_t reader, const char *prompt);
 parser_t parser_create(tokenizer_t tokenizer);
-element_t parser_next(parser_t parser);
-void element_free(element_t elt);
+void parser_next(parser_t parser, element_t elt);
+void element_release(element_t elt);
 void parser_free(parser_t parser);
+void parser_set_check(parser_t parser, int check);
+unsigned int parser_line(parser_t parser);
 void tokenizer_free(tokenizer_t tokenizer);
 void reader_free(reader_t reader);
+void command_arg(command_t command, const char *arg, unsigned int len);
+void command_redir(command_t command, element_t elt);
+void command_add_redir(command_t command, int type, int fd, unsigned int fd2,
+										const char *name, unsigned int len);
+void command_copy(command_t dst, command_t src, int first);
+void command_finish(command_t command);
+void command_clear(command_t command);
+void command_free(command_t command);
 void interpret(reader_t reader, int interactive);
+int interpret_file(const char *file, char **argv);
 
 void interrupts_disable();
 void interrupts_enable();
 void interrupts_catch();
-void perform(command_t command, int background);
+int interrupts_pending();
+void interrupts_reset();
+int perform(command_t command, int background);
+int builtin_find(const char *name);
+int perform_pipeline(command_t *stages, int n, int background);
+int redirect_push(command_t command, struct fdsave *save);
+void redirect_pop(struct fdsave *save);
+extern int last_status;
+block_t block_create();
+int block_command(block_t block, command_t command, int background);
+void block_pipe_cancel(block_t block);
+void block_free(block_t block);
+int expand(command_t out, command_t in);
+int arith_eval(const char *expr, long long *result);
+char *var_get(const char *name, unsigned int len);
+void var_set(const char *name, const char *value);
+void var_unset(const char *name);
+void var_clear();
+int var_name(const char *name, unsigned int len);
+void textutil_enable(int on);
+int textutil_check(command_t command);
+int textutil_run(command_t command);
+const char *path_lookup(const char *name, int *script);
+int path_handle(const char *file);
+void path_exec(const char *file, char **argv);
+int check_script(int fd);
+int fdtab_id(const char *name, unsigned int len);
+int fdtab_lookup(int fd);
+int fdtab_fd(int fd);
+int fdtab_open(int id, const char *file, int flags);
+int fdtab_dup(int id, int fd);
+int fdtab_close(int id);
+void mem_enable();
+void mem_leaks();
+int memstat(command_t command);
+void fdreaders_free();
+void fds_init();
+int record_open(const char *file);
+void record_input(char c);
+void record_spawn(int pid, const char *name);
+void record_reap(int pid, int status);
+int replay_open(const char *file);
+long replay_command(const char *name, int background, int *status);
+int status_open(const char *file);
+void status_printf(const char *fmt, ...);
+void status_signal(int sig);
+void status_flush();
+void status_child();
+int limit_set(double rate, double burst);
+int limit_parse(const char *spec);
+void limit_spawn();
+int spawnlimit(command_t command);
+int pool(command_t command);
+int pool_run(command_t command, int background);
+int buf_open(const char *file, int flags);
+void buf_prepare(command_t command);
+int buf_setmax(const char *size);
+int buffree(command_t command);
+int decode_format(const char *name);
+void decode(int fd, int format);
+void decode_buffer(const char *buf, unsigned int len, int format);
+int shallc(int argc, char **argv);
+char *plan_load(unsigned int *len);
+void path_seed(const char *name, const char *file);
+int jobs_group(const char *name);
+int jobs_find(const char *name);
+void jobs_add(int pid, int background);
+void jobs_reaped(int pid, int status);
+int jobs_running(int background);
+int jobs_status(int background);
+int jobs_next(int *status);
+void jobs_forget();
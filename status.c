@@ -0,0 +1,157 @@
+/* Status messages of the shall, such as which processes terminated.
+ *
+ * The messages are collected in a buffer of their own rather than going
+ * through stdout, where they would mix with what commands write and be
+ * flushed whenever a command starts.  The buffer is written out with a
+ * single writev() once per command read, or when it is full.  Signal
+ * handlers cannot use the buffer, so they write the signal number to a
+ * pipe instead, and its message is added when the buffer is written.
+ *
+ * The messages go to standard error, to a file, or nowhere.  Only the
+ * shall writes them, not the children it forks, except for a child that
+ * runs a shall script, which reports on its own processes.
+ *
+ * The interface is as follows:
+ *	int status_open(const char *file):
+ *		Send the messages to the given file, to standard error if file
+ *		is 0, or nowhere if it is "".  Returns -1 on error.
+ *
+ *	void status_printf(const char *fmt, ...):
+ *		Add a message.
+ *
+ *	void status_signal(int sig):
+ *		Add a message that signal sig was received.  Can be called from
+ *		a signal handler.
+ *
+ *	void status_flush():
+ *		Write out the messages added so far.
+ *
+ *	void status_child():
+ *		Make a forked child that runs a shall script write its own
+ *		messages.
+ */
+
+#define _GNU_SOURCE
+#include <sys/uio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include "shall.h"
+
+#define STATUS_BUFSIZE	4096
+
+static int statusfd = 2;		// where the messages go, -1 if nowhere
+static int statusowner;			// process that writes them, not its children
+static int sigpipe[2] = { -1, -1 };
+static char statusbuf[STATUS_BUFSIZE];
+static unsigned int statuslen;
+
+/* Write the buffered messages and those for the signals received.
+ */
+void status_flush(){
+	char signals[STATUS_BUFSIZE / 2], sigs[64];
+	unsigned int nsignals = 0;
+	struct iovec iov[2];
+	int i, n;
+
+	if (sigpipe[0] >= 0) {
+		while ((n = read(sigpipe[0], sigs, sizeof(sigs))) > 0) {
+			for (i = 0; i < n && nsignals < sizeof(signals) - 32; i++) {
+				nsignals += sprintf(signals + nsignals, "got signal %d\n", sigs[i]);
+			}
+		}
+	}
+	if (statuslen == 0 && nsignals == 0) {
+		return;
+	}
+	if (statusfd >= 0 && getpid() == statusowner) {
+		iov[0].iov_base = statusbuf;
+		iov[0].iov_len = statuslen;
+		iov[1].iov_base = signals;
+		iov[1].iov_len = nsignals;
+		for (i = 0; i < 2; ) {
+			if ((n = writev(statusfd, &iov[i], 2 - i)) < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				break;
+			}
+			while (i < 2 && (size_t) n >= iov[i].iov_len) {
+				n -= iov[i++].iov_len;
+			}
+			if (i < 2) {
+				iov[i].iov_base = (char *) iov[i].iov_base + n;
+				iov[i].iov_len -= n;
+			}
+		}
+	}
+	statuslen = 0;
+}
+
+void status_printf(const char *fmt, ...){
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(statusbuf + statuslen, STATUS_BUFSIZE - statuslen, fmt, ap);
+	va_end(ap);
+	if (n >= STATUS_BUFSIZE - statuslen) {			// did not fit
+		status_flush();
+		va_start(ap, fmt);
+		n = vsnprintf(statusbuf, STATUS_BUFSIZE, fmt, ap);
+		va_end(ap);
+		if (n >= STATUS_BUFSIZE) {
+			n = STATUS_BUFSIZE - 1;
+		}
+	}
+	if (n > 0) {
+		statuslen += n;
+	}
+}
+
+void status_signal(int sig){
+	int saved = errno;
+	char c = sig;
+
+	if (sigpipe[1] >= 0) {
+		write(sigpipe[1], &c, 1);
+	}
+	errno = saved;
+}
+
+void status_child(){
+	statuslen = 0;					// the parent's, which it writes itself
+	if (sigpipe[0] >= 0) {
+		close(sigpipe[0]);
+		close(sigpipe[1]);
+		if (pipe2(sigpipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+			sigpipe[0] = sigpipe[1] = -1;
+		}
+	}
+	statusowner = getpid();
+}
+
+int status_open(const char *file){
+	if (file == 0) {
+		statusfd = 2;
+	}
+	else if (*file == 0) {
+		statusfd = -1;
+	}
+	else if ((statusfd = open(file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0666)) < 0) {
+		perror(file);
+		return -1;
+	}
+	if (sigpipe[0] < 0) {
+		if (pipe2(sigpipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+			sigpipe[0] = sigpipe[1] = -1;
+		}
+		atexit(status_flush);
+	}
+	statusowner = getpid();
+	return 0;
+}
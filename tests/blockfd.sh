@@ -0,0 +1,32 @@
+#!/bin/sh
+# The redirections of a block or loop apply to every command in it, also
+# to a descriptor above 2 that the commands write to (see redirect_push()
+# in exec.c); after the block, they no longer do.
+#
+#	sh tests/blockfd.sh ./shall
+
+shall=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' 0
+
+cat > "$dir/s" <<'END'
+begin
+/bin/sh -c 'echo begin >&7'
+end {7}>f
+i=0
+while test $i != 000; do
+/bin/sh -c 'echo while >&7'
+i=0$i
+done {7}>g
+/bin/sh -c 'echo after >&7' {2}>/dev/null
+END
+out=$(cd "$dir" && { "$shall" -q s; cat f g; } 2>&1)
+expect="begin
+while
+while"
+if [ "$out" != "$expect" ]; then
+	echo "blockfd: expected:"; echo "$expect"
+	echo "blockfd: got:"; echo "$out"
+	exit 1
+fi
+echo "blockfd: ok"
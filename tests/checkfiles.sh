@@ -0,0 +1,21 @@
+#!/bin/sh
+# 'shall -n' does not complain about input from a file that an earlier
+# command creates with '>' (see check.c), but still does about one that
+# is only created later, or only appended to.
+#
+#	sh tests/checkfiles.sh ./shall
+
+shall=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' 0
+
+printf 'ls > t; /bin/cat < t\n/bin/cat < u\nls > u\nls >> v\n/bin/cat < v\n' > "$dir/s"
+out=$(cd "$dir" && "$shall" -n s 2>&1)
+expect="line 2: < u: No such file or directory
+line 5: < v: No such file or directory"
+if [ "$out" != "$expect" ]; then
+	echo "checkfiles: expected:"; echo "$expect"
+	echo "checkfiles: got:"; echo "$out"
+	exit 1
+fi
+echo "checkfiles: ok"
@@ -0,0 +1,22 @@
+#!/bin/sh
+# 'shall -n' reports a redirection cut short by the end of the line on
+# the line where it started, and goes on checking the next line as a
+# command of its own (see parser.c).
+#
+#	sh tests/checkparse.sh ./shall
+
+shall=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' 0
+
+printf 'echo {x\nls\nls >\n\necho fine\necho a {x} b\n' > "$dir/s"
+out=$(cd "$dir" && "$shall" -n s 2>&1)
+expect="line 1: unexpected newline
+line 3: unexpected newline
+line 6: expected a redirection character"
+if [ "$out" != "$expect" ]; then
+	echo "checkparse: expected:"; echo "$expect"
+	echo "checkparse: got:"; echo "$out"
+	exit 1
+fi
+echo "checkparse: ok"
@@ -0,0 +1,17 @@
+#!/bin/sh
+# A binary record whose length is out of all proportion is rejected,
+# rather than wrapping around or growing the buffer without end (see
+# decode.c).
+#
+#	sh tests/decodelen.sh ./shall
+
+shall=$1
+
+out=$(printf '\377\377\377\377wxyz' | "$shall" -q --input-format=binary 2>&1)
+expect="input: record too long"
+if [ "$out" != "$expect" ]; then
+	echo "decodelen: expected:"; echo "$expect"
+	echo "decodelen: got:"; echo "$out"
+	exit 1
+fi
+echo "decodelen: ok"
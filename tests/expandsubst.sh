@@ -0,0 +1,20 @@
+#!/bin/sh
+# ${NAME:-word}, ${NAME:=word} and ${NAME:+word} are reported as not
+# supported rather than taken as substrings with a negative offset,
+# which is written ${NAME: -1} (see expand.c).
+#
+#	sh tests/expandsubst.sh ./shall
+
+shall=$1
+
+out=$("$shall" -q -c 'x=hello; /bin/echo ${x:-foo}; /bin/echo ${x:=a}; /bin/echo ${x:+b}; /bin/echo ${x: -2} ${x:1:2}' 2>&1)
+expect="bad substitution: ':-' is not supported
+bad substitution: ':=' is not supported
+bad substitution: ':+' is not supported
+lo el"
+if [ "$out" != "$expect" ]; then
+	echo "expandsubst: expected:"; echo "$expect"
+	echo "expandsubst: got:"; echo "$out"
+	exit 1
+fi
+echo "expandsubst: ok"
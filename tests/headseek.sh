@@ -0,0 +1,26 @@
+#!/bin/sh
+# The in-process 'head' (shall -u) leaves a seekable standard input just
+# past the lines it printed, as GNU head does, and starts where a 'while
+# read' loop has logically stopped reading (see textutil.c).
+#
+#	sh tests/headseek.sh ./shall
+
+shall=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' 0
+
+printf 'a\nb\nc\nd\n' > "$dir/f"
+out=$(cd "$dir" && { "$shall" -q -u -c 'head -n1; head -n1; /bin/cat' < f
+	"$shall" -q -u -c 'while read x; do head -n1; done < f'; } 2>&1)
+expect="a
+b
+c
+d
+b
+d"
+if [ "$out" != "$expect" ]; then
+	echo "headseek: expected:"; echo "$expect"
+	echo "headseek: got:"; echo "$out"
+	exit 1
+fi
+echo "headseek: ok"
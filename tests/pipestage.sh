@@ -0,0 +1,29 @@
+#!/bin/sh
+# A stage of a pipeline execs its command without forking again (see
+# perform_pipeline() in exec.c), but a script or sourced file that the
+# stage runs must still run all of its commands.
+#
+#	sh tests/pipestage.sh ./shall
+
+shall=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' 0
+
+cat > "$dir/s" <<END
+#!$shall
+/bin/echo one
+/bin/echo two
+END
+chmod +x "$dir/s"
+
+out=$(cd "$dir" && "$shall" -q -c './s | /bin/cat; source s | /bin/cat' 2>&1)
+expect="one
+two
+one
+two"
+if [ "$out" != "$expect" ]; then
+	echo "pipestage: expected:"; echo "$expect"
+	echo "pipestage: got:"; echo "$out"
+	exit 1
+fi
+echo "pipestage: ok"
@@ -0,0 +1,25 @@
+#!/bin/sh
+# Redefining a pool stops its workers and reaps them, also one that
+# ignores SIGTERM (see worker_stop() in pool.c): no worker is left as a
+# child of the shall, running or dead.
+#
+#	sh tests/poolstop.sh ./shall
+
+shall=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' 0
+
+cat > "$dir/s" <<'END'
+pool p 1 /bin/sh -c 'trap "" TERM; exec /bin/sleep 100'
+@pool p /bin/true &
+pool p 1 /bin/true
+/bin/ps -o comm= --ppid $$
+END
+out=$(cd "$dir" && "$shall" -q s 2>&1)
+expect="ps"
+if [ "$out" != "$expect" ]; then
+	echo "poolstop: expected:"; echo "$expect"
+	echo "poolstop: got:"; echo "$out"
+	exit 1
+fi
+echo "poolstop: ok"
@@ -0,0 +1,41 @@
+#!/bin/sh
+# A redirection to a descriptor above 2 must reach the command, also when
+# the file happens to open on that very descriptor (close-on-exec is then
+# cleared, see redir_file() in exec.c); and the shall's own descriptors,
+# however many, must not.
+#
+#	sh tests/redirfd.sh ./shall
+
+shall=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' 0
+
+fail(){
+	echo "redirfd: $1: expected:"; echo "$2"
+	echo "redirfd: $1: got:"; echo "$3"
+	exit 1
+}
+
+(cd "$dir" && "$shall" -q -c "/bin/sh -c 'echo hi >&5' {5}>f5; exec {5}>f6; /bin/sh -c 'echo there >&5'")
+out=$(cat "$dir/f5" "$dir/f6" 2>&1)
+expect="hi
+there"
+[ "$out" = "$expect" ] || fail "fd 5" "$expect" "$out"
+
+# Many named descriptors, then many commands: each command starts with
+# 0, 1, 2 and the directory that ls reads.
+i=0
+while [ $i -lt 1000 ]; do
+	echo "exec {f$i}</dev/null"
+	i=$((i + 1))
+done > "$dir/s"
+i=0
+while [ $i -lt 200 ]; do
+	echo "/bin/true"
+	i=$((i + 1))
+done >> "$dir/s"
+echo "/bin/ls /proc/self/fd | /usr/bin/wc -l" >> "$dir/s"
+out=$("$shall" -q "$dir/s" 2>&1)
+expect=4
+[ "$out" -eq "$expect" ] 2>/dev/null || fail "many fds" "$expect" "$out"
+echo "redirfd: ok"
@@ -0,0 +1,29 @@
+#!/bin/sh
+# A '#!shall' script runs in a forked copy of the shall (see exec.c), which
+# must still have the descriptors behind the tables that it inherits: the
+# directories of 'in', and the buffers of 'buf:NAME'.  The shall that
+# runs the script fills them first.
+#
+#	sh tests/scriptfds.sh ./shall
+
+shall=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' 0
+
+mkdir "$dir/sub"
+cat > "$dir/t" <<END
+#!$shall
+in sub /bin/pwd
+/bin/cat <buf:b
+END
+chmod +x "$dir/t"
+
+out=$(cd "$dir" && "$shall" -q -c 'in sub /bin/true; /bin/echo hello >buf:b; ./t' 2>&1)
+expect="$(cd "$dir/sub" && pwd -P)
+hello"
+if [ "$out" != "$expect" ]; then
+	echo "scriptfds: expected:"; echo "$expect"
+	echo "scriptfds: got:"; echo "$out"
+	exit 1
+fi
+echo "scriptfds: ok"
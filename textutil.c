@@ -0,0 +1,840 @@
+/* In-process versions of 'wc', 'grep -F', 'head' and 'tail'.
+ *
+ * Scripts tend to run these utilities on large files over and over, and
+ * each run costs a fork() and an exec().  When enabled (shall -u), the
+ * common forms of these commands are run inside the shall instead.  Any
+ * option that is not understood here causes the external program to be
+ * used, so the builtins can be switched on and off freely.
+ *
+ * Regular files are mapped into memory.  Counting newlines and searching
+ * for a fixed string use AVX2 or SSE2 where the processor has them, and
+ * fall back to plain C otherwise.
+ *
+ * The interface is as follows:
+ *	void textutil_enable(int on):
+ *		Turn the builtins on or off.
+ *
+ *	int textutil_check(command_t command):
+ *		Return 1 if the command can be run in-process.
+ *
+ *	int textutil_run(command_t command):
+ *		Run the command and return its exit status.  Redirections
+ *		should already have been applied to the shall.
+ */
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TEXTUTIL_X86
+#endif
+#include "shall.h"
+
+#define OUTBUF		(64 * 1024)
+
+static int enabled;
+
+/* Options of the supported utilities.
+ */
+struct opts {
+	int lines, words, bytes;		// wc -l, -w, -c
+	int count, invert, number, quiet;	// grep -c, -v, -n, -q
+	long n;							// head/tail -n
+	char *pattern;					// grep pattern
+	char **files;					// null-terminated list of files
+	int nfiles;
+};
+
+/* A file mapped or read into memory.
+ */
+struct input {
+	const char *data;
+	size_t len;
+	void *map;						// mapping to release, or
+	char *buf;						// buffer to release
+	int regular;					// input is a regular file
+};
+
+/* Buffered output on file descriptor 1.
+ */
+static char outbuf[OUTBUF];
+static size_t outlen;
+
+/************************************************************************
+ * Kernels.
+ ************************************************************************/
+
+static size_t count_scalar(const char *p, size_t n){
+	size_t count = 0;
+	const char *end = p + n;
+
+	while ((p = memchr(p, '\n', end - p)) != 0) {
+		count++;
+		p++;
+	}
+	return count;
+}
+
+/* Plain memmem() is the fallback for the fixed-string search.
+ */
+static const char *search_scalar(const char *hay, size_t n, const char *needle, size_t m){
+	return memmem(hay, n, needle, m);
+}
+
+#ifdef TEXTUTIL_X86
+
+/* Count newlines 16 bytes at a time.  Matches are accumulated in byte
+ * counters, which are summed up before they can overflow.
+ */
+__attribute__((target("sse2")))
+static size_t count_sse2(const char *p, size_t n){
+	const __m128i nl = _mm_set1_epi8('\n');
+	const __m128i zero = _mm_setzero_si128();
+	size_t count = 0, i = 0;
+
+	while (i + 16 <= n) {
+		__m128i acc = _mm_setzero_si128();
+		int k;
+		for (k = 0; k < 255 && i + 16 <= n; k++, i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, nl));
+		}
+		__m128i sums = _mm_sad_epu8(acc, zero);
+		count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+	}
+	return count + count_scalar(p + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t count_avx2(const char *p, size_t n){
+	const __m256i nl = _mm256_set1_epi8('\n');
+	const __m256i zero = _mm256_setzero_si256();
+	size_t count = 0, i = 0;
+
+	while (i + 32 <= n) {
+		__m256i acc = _mm256_setzero_si256();
+		int k;
+		for (k = 0; k < 255 && i + 32 <= n; k++, i += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+			acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, nl));
+		}
+		__m256i sums = _mm256_sad_epu8(acc, zero);
+		count += _mm256_extract_epi64(sums, 0) + _mm256_extract_epi64(sums, 1)
+			   + _mm256_extract_epi64(sums, 2) + _mm256_extract_epi64(sums, 3);
+	}
+	return count + count_scalar(p + i, n - i);
+}
+
+/* Fixed-string search: compare the first and the last byte of the needle
+ * at 16 positions at once, and only check candidates that match both.
+ */
+__attribute__((target("sse2")))
+static const char *search_sse2(const char *hay, size_t n, const char *needle, size_t m){
+	if (m < 2) {
+		return m == 0 ? hay : memchr(hay, needle[0], n);
+	}
+
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[m - 1]);
+	size_t i = 0;
+
+	for (; i + m - 1 + 16 <= n; i += 16) {
+		__m128i f = _mm_loadu_si128((const __m128i *) (hay + i));
+		__m128i l = _mm_loadu_si128((const __m128i *) (hay + i + m - 1));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(
+							_mm_cmpeq_epi8(f, first), _mm_cmpeq_epi8(l, last)));
+		while (mask != 0) {
+			unsigned int bit = __builtin_ctz(mask);
+			if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) {
+				return hay + i + bit;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return search_scalar(hay + i, n - i, needle, m);
+}
+
+__attribute__((target("avx2")))
+static const char *search_avx2(const char *hay, size_t n, const char *needle, size_t m){
+	if (m < 2) {
+		return m == 0 ? hay : memchr(hay, needle[0], n);
+	}
+
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+	size_t i = 0;
+
+	for (; i + m - 1 + 32 <= n; i += 32) {
+		__m256i f = _mm256_loadu_si256((const __m256i *) (hay + i));
+		__m256i l = _mm256_loadu_si256((const __m256i *) (hay + i + m - 1));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(
+							_mm256_cmpeq_epi8(f, first), _mm256_cmpeq_epi8(l, last)));
+		while (mask != 0) {
+			unsigned int bit = __builtin_ctz(mask);
+			if (memcmp(hay + i + bit + 1, needle + 1, m - 2) == 0) {
+				return hay + i + bit;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return search_scalar(hay + i, n - i, needle, m);
+}
+
+#endif // TEXTUTIL_X86
+
+static size_t (*count_newlines)(const char *p, size_t n) = count_scalar;
+static const char *(*search)(const char *hay, size_t n, const char *needle, size_t m) = search_scalar;
+
+/* Pick the best kernels for this processor.
+ */
+static void kernels_init(){
+#ifdef TEXTUTIL_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		count_newlines = count_avx2;
+		search = search_avx2;
+	}
+	else if (__builtin_cpu_supports("sse2")) {
+		count_newlines = count_sse2;
+		search = search_sse2;
+	}
+#endif
+}
+
+/************************************************************************
+ * Input and output.
+ ************************************************************************/
+
+static void write_all(int fd, const char *p, size_t n){
+	while (n > 0) {
+		ssize_t r = write(fd, p, n);
+		if (r < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return;
+		}
+		p += r;
+		n -= r;
+	}
+}
+
+static void out_flush(){
+	write_all(1, outbuf, outlen);
+	outlen = 0;
+}
+
+/* Large blocks, typically straight out of a mapped file, are written
+ * without copying them.
+ */
+static void out_write(const char *p, size_t n){
+	if (outlen + n > OUTBUF || n >= OUTBUF / 2) {
+		out_flush();
+	}
+	if (n >= OUTBUF / 2) {
+		write_all(1, p, n);
+	}
+	else {
+		memcpy(outbuf + outlen, p, n);
+		outlen += n;
+	}
+}
+
+static void out_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+static void out_printf(const char *fmt, ...){
+	va_list ap;
+
+	if (outlen + 256 > OUTBUF) {
+		out_flush();
+	}
+	va_start(ap, fmt);
+	int n = vsnprintf(outbuf + outlen, OUTBUF - outlen, fmt, ap);
+	va_end(ap);
+	if (n > 0) {
+		outlen += (size_t) n < OUTBUF - outlen ? (size_t) n : OUTBUF - outlen - 1;
+	}
+}
+
+/* Map or read the whole contents of a file into memory.  If name is
+ * 0 or "-", standard input is used, and its file offset is left at
+ * the end.  If the whole file is going to be scanned, the mapping is
+ * populated up front rather than page by page.
+ */
+static int input_open(struct input *in, const char *name, const char *util, int scan){
+	int fd = 0;
+	struct stat st;
+
+	memset(in, 0, sizeof(*in));
+	if (name != 0 && strcmp(name, "-") != 0) {
+		if ((fd = open(name, O_RDONLY | O_CLOEXEC)) < 0) {
+			fprintf(stderr, "%s: %s: %s\n", util, name, strerror(errno));
+			return -1;
+		}
+	}
+
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		off_t off = lseek(fd, 0, SEEK_CUR);
+		in->regular = 1;
+		if (off < 0) {
+			off = 0;
+		}
+		if (st.st_size > off) {
+			in->map = mmap(0, st.st_size, PROT_READ,
+						MAP_PRIVATE | (scan ? MAP_POPULATE : 0), fd, 0);
+			if (in->map == MAP_FAILED) {
+				in->map = 0;
+			}
+			else {
+				in->data = (char *) in->map + off;
+				in->len = st.st_size - off;
+				if (fd == 0) {
+					lseek(fd, 0, SEEK_END);
+				}
+			}
+		}
+		if (in->map != 0 || st.st_size <= off) {
+			if (fd != 0) {
+				close(fd);
+			}
+			return 0;
+		}
+	}
+
+	size_t max = 64 * 1024;
+	in->buf = malloc(max);
+	for (;;) {
+		if (in->len == max) {
+			max *= 2;
+			in->buf = realloc(in->buf, max);
+		}
+		ssize_t n = read(fd, in->buf + in->len, max - in->len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		in->len += n;
+	}
+	in->data = in->buf;
+	if (fd != 0) {
+		close(fd);
+	}
+	return 0;
+}
+
+static void input_close(struct input *in){
+	if (in->map != 0) {
+		munmap(in->map, (in->data - (char *) in->map) + in->len);
+	}
+	free(in->buf);
+}
+
+/************************************************************************
+ * Option parsing.  Each returns -1 if the command uses anything that
+ * is not implemented here.
+ ************************************************************************/
+
+/* Parse the count of 'head -n N', 'head -nN' or 'head -N'.
+ */
+static int parse_count(const char *s, long *n){
+	char *end;
+
+	if (*s < '0' || *s > '9') {
+		return -1;
+	}
+	*n = strtol(s, &end, 10);
+	return *end == 0 ? 0 : -1;
+}
+
+static int parse_files(char **argv, struct opts *o){
+	o->files = argv;
+	for (o->nfiles = 0; argv[o->nfiles] != 0; o->nfiles++)
+		;
+	return 0;
+}
+
+static int parse_wc(char **argv, struct opts *o){
+	for (argv++; *argv != 0 && (*argv)[0] == '-' && (*argv)[1] != 0; argv++) {
+		char *p;
+		if (strcmp(*argv, "--") == 0) {
+			argv++;
+			break;
+		}
+		for (p = *argv + 1; *p != 0; p++) {
+			switch (*p) {
+			case 'l': o->lines = 1; break;
+			case 'w': o->words = 1; break;
+			case 'c': o->bytes = 1; break;
+			default: return -1;
+			}
+		}
+	}
+	if (!o->lines && !o->words && !o->bytes) {
+		o->lines = o->words = o->bytes = 1;
+	}
+	return parse_files(argv, o);
+}
+
+static int parse_grep(char **argv, struct opts *o){
+	int fixed = 0;
+
+	for (argv++; *argv != 0 && (*argv)[0] == '-' && (*argv)[1] != 0; argv++) {
+		char *p;
+		if (strcmp(*argv, "--") == 0) {
+			argv++;
+			break;
+		}
+		for (p = *argv + 1; *p != 0; p++) {
+			switch (*p) {
+			case 'F': fixed = 1; break;
+			case 'c': o->count = 1; break;
+			case 'v': o->invert = 1; break;
+			case 'n': o->number = 1; break;
+			case 'q': o->quiet = 1; break;
+			default: return -1;
+			}
+		}
+	}
+	if (!fixed || *argv == 0 || strchr(*argv, '\n') != 0) {
+		return -1;
+	}
+	o->pattern = *argv++;
+	return parse_files(argv, o);
+}
+
+static int parse_headtail(char **argv, struct opts *o){
+	o->n = 10;
+	for (argv++; *argv != 0 && (*argv)[0] == '-' && (*argv)[1] != 0; argv++) {
+		if (strcmp(*argv, "--") == 0) {
+			argv++;
+			break;
+		}
+		if (strcmp(*argv, "-n") == 0) {
+			if (argv[1] == 0 || parse_count(argv[1], &o->n) < 0) {
+				return -1;
+			}
+			argv++;
+		}
+		else if ((*argv)[1] == 'n') {
+			if (parse_count(*argv + 2, &o->n) < 0) {
+				return -1;
+			}
+		}
+		else if (parse_count(*argv + 1, &o->n) < 0) {
+			return -1;
+		}
+	}
+	return parse_files(argv, o);
+}
+
+/************************************************************************
+ * The utilities.
+ ************************************************************************/
+
+static int digits(size_t n){
+	int d = 1;
+
+	while (n >= 10) {
+		n /= 10;
+		d++;
+	}
+	return d;
+}
+
+static size_t count_words(const char *p, size_t n){
+	size_t words = 0, i;
+	int inword = 0;
+
+	for (i = 0; i < n; i++) {
+		if (isspace((unsigned char) p[i])) {
+			inword = 0;
+		}
+		else if (!inword) {
+			inword = 1;
+			words++;
+		}
+	}
+	return words;
+}
+
+/* Print one line of wc output in the format of GNU wc.
+ */
+static void wc_print(struct opts *o, size_t *counts, int width, const char *name){
+	const char *sep = "";
+
+	if (o->lines) {
+		out_printf("%*zu", width, counts[0]);
+		sep = " ";
+	}
+	if (o->words) {
+		out_printf("%s%*zu", sep, width, counts[1]);
+		sep = " ";
+	}
+	if (o->bytes) {
+		out_printf("%s%*zu", sep, width, counts[2]);
+	}
+	if (name != 0) {
+		out_printf(" %s", name);
+	}
+	out_printf("\n");
+}
+
+static int wc(struct opts *o){
+	int nin = o->nfiles == 0 ? 1 : o->nfiles;
+	size_t (*counts)[3] = calloc(nin, sizeof(*counts));
+	size_t total[3] = { 0, 0, 0 }, size = 0;
+	int i, status = 0, irregular = 0, *failed = calloc(nin, sizeof(int));
+
+	for (i = 0; i < nin; i++) {
+		struct input in;
+		if (input_open(&in, o->nfiles == 0 ? 0 : o->files[i], "wc", 1) < 0) {
+			failed[i] = 1;
+			status = 1;
+			continue;
+		}
+		if (o->lines) {
+			counts[i][0] = count_newlines(in.data, in.len);
+		}
+		if (o->words) {
+			counts[i][1] = count_words(in.data, in.len);
+		}
+		counts[i][2] = in.len;
+		total[0] += counts[i][0];
+		total[1] += counts[i][1];
+		total[2] += counts[i][2];
+		if (in.regular) {
+			size += in.len;
+		}
+		else {
+			irregular = 1;
+		}
+		input_close(&in);
+	}
+
+	/* GNU wc only pads its columns if there is more than one number.
+	 */
+	int width = 1;
+	if (nin > 1 || o->lines + o->words + o->bytes > 1) {
+		width = digits(size);
+		if (irregular && width < 7) {
+			width = 7;
+		}
+	}
+	for (i = 0; i < nin; i++) {
+		if (!failed[i]) {
+			wc_print(o, counts[i], width, o->nfiles == 0 ? 0 : o->files[i]);
+		}
+	}
+	if (nin > 1) {
+		wc_print(o, total, width, "total");
+	}
+	out_flush();
+	free(counts);
+	free(failed);
+	return status;
+}
+
+/* Write a selected line, with the prefixes grep would put in front of it.
+ */
+static void grep_line(struct opts *o, const char *name, size_t lineno, const char *p, const char *end){
+	if (name != 0) {
+		out_printf("%s:", name);
+	}
+	if (o->number) {
+		out_printf("%zu:", lineno);
+	}
+	out_write(p, end - p);
+	if (end[-1] != '\n') {
+		out_write("\n", 1);
+	}
+}
+
+/* Scan one input for the pattern.  Between two matches, all lines are
+ * non-matching, so for -v they can be copied out as a block.
+ */
+static size_t grep_input(struct opts *o, struct input *in, const char *name){
+	const char *p = in->data, *end = in->data + in->len;
+	size_t m = strlen(o->pattern), selected = 0, lineno = 1;
+
+	while (p < end) {
+		const char *hit = search(p, end - p, o->pattern, m);
+		const char *bol, *eol;
+
+		if (hit == 0) {
+			bol = eol = end;
+		}
+		else {
+			bol = hit;
+			while (bol > p && bol[-1] != '\n') {
+				bol--;
+			}
+			eol = memchr(hit, '\n', end - hit);
+			eol = eol == 0 ? end : eol + 1;
+		}
+
+		/* Lines p..bol do not match.
+		 */
+		if (o->invert && bol > p) {
+			size_t nlines = count_newlines(p, bol - p);
+			if (bol == end && end[-1] != '\n') {
+				nlines++;
+			}
+			selected += nlines;
+			if (o->quiet) {
+				return selected;
+			}
+			if (!o->count) {
+				if (name == 0 && !o->number) {
+					out_write(p, bol - p);
+					if (bol == end && end[-1] != '\n') {
+						out_write("\n", 1);
+					}
+				}
+				else {
+					const char *q = p;
+					size_t ln = lineno;
+					while (q < bol) {
+						const char *e = memchr(q, '\n', bol - q);
+						e = e == 0 ? bol : e + 1;
+						grep_line(o, name, ln++, q, e);
+						q = e;
+					}
+				}
+			}
+		}
+		if (o->number || o->invert) {
+			lineno += count_newlines(p, bol - p);
+		}
+		if (bol == end) {
+			break;
+		}
+
+		/* Line bol..eol matches.
+		 */
+		if (!o->invert) {
+			selected++;
+			if (o->quiet) {
+				return selected;
+			}
+			if (!o->count) {
+				grep_line(o, name, lineno, bol, eol);
+			}
+		}
+		lineno++;
+		p = eol;
+	}
+	return selected;
+}
+
+static int grep(struct opts *o){
+	int nin = o->nfiles == 0 ? 1 : o->nfiles;
+	int i, error = 0;
+	size_t selected = 0;
+
+	for (i = 0; i < nin; i++) {
+		struct input in;
+		const char *name = o->nfiles > 1 ? o->files[i] : 0;
+
+		if (input_open(&in, o->nfiles == 0 ? 0 : o->files[i], "grep", 1) < 0) {
+			error = 1;
+			continue;
+		}
+		size_t n = grep_input(o, &in, name);
+		input_close(&in);
+		selected += n;
+		if (o->quiet && n > 0) {
+			break;
+		}
+		if (o->count) {
+			if (name != 0) {
+				out_printf("%s:", name);
+			}
+			out_printf("%zu\n", n);
+		}
+	}
+	out_flush();
+	if (error && !(o->quiet && selected > 0)) {
+		return 2;
+	}
+	return selected > 0 ? 0 : 1;
+}
+
+/* Copy the first o->n lines of a pipe or terminal without reading any
+ * further than needed.
+ */
+static void head_stream(struct opts *o){
+	char buf[OUTBUF];
+	long left = o->n;
+
+	while (left > 0) {
+		ssize_t n = read(0, buf, sizeof(buf));
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		if (n <= 0) {
+			break;
+		}
+		const char *p = buf, *end = buf + n;
+		while (left > 0 && p < end) {
+			const char *nl = memchr(p, '\n', end - p);
+			if (nl == 0) {
+				p = end;
+				break;
+			}
+			p = nl + 1;
+			left--;
+		}
+		write_all(1, buf, p - buf);
+	}
+}
+
+static void headtail_header(struct opts *o, int i){
+	if (o->nfiles > 1) {
+		out_printf("%s==> %s <==\n", i == 0 ? "" : "\n", o->files[i]);
+	}
+}
+
+static int head(struct opts *o){
+	int nin = o->nfiles == 0 ? 1 : o->nfiles;
+	int i, status = 0;
+
+	for (i = 0; i < nin; i++) {
+		const char *name = o->nfiles == 0 ? 0 : o->files[i];
+		struct stat st;
+		struct input in;
+
+		if ((name == 0 || strcmp(name, "-") == 0)
+					&& (fstat(0, &st) < 0 || !S_ISREG(st.st_mode))) {
+			headtail_header(o, i);
+			out_flush();
+			head_stream(o);
+			continue;
+		}
+		if (input_open(&in, name, "head", 0) < 0) {
+			status = 1;
+			continue;
+		}
+		headtail_header(o, i);
+		const char *p = in.data, *end = in.data + in.len;
+		long left;
+		for (left = o->n; left > 0 && p < end; left--) {
+			const char *nl = memchr(p, '\n', end - p);
+			p = nl == 0 ? end : nl + 1;
+		}
+		out_write(in.data, p - in.data);
+		if (in.regular && (name == 0 || strcmp(name, "-") == 0)) {
+			lseek(0, p - end, SEEK_CUR);	// leave the rest to the next command
+		}
+		input_close(&in);
+	}
+	out_flush();
+	return status;
+}
+
+static int tail(struct opts *o){
+	int nin = o->nfiles == 0 ? 1 : o->nfiles;
+	int i, status = 0;
+
+	for (i = 0; i < nin; i++) {
+		struct input in;
+
+		if (input_open(&in, o->nfiles == 0 ? 0 : o->files[i], "tail", 0) < 0) {
+			status = 1;
+			continue;
+		}
+		headtail_header(o, i);
+		const char *p = in.data + in.len;
+		long left = o->n;
+
+		/* A final newline terminates the last line rather than starting
+		 * another one.
+		 */
+		if (p > in.data && p[-1] == '\n') {
+			p--;
+		}
+		while (left > 0 && p > in.data) {
+			const char *nl = memrchr(in.data, '\n', p - in.data);
+			if (nl == 0) {
+				p = in.data;
+				break;
+			}
+			if (--left > 0) {
+				p = nl;
+			}
+			else {
+				p = nl + 1;
+			}
+		}
+		if (o->n == 0) {
+			p = in.data + in.len;
+		}
+		out_write(p, in.data + in.len - p);
+		input_close(&in);
+	}
+	out_flush();
+	return status;
+}
+
+/************************************************************************
+ * Interface.
+ ************************************************************************/
+
+static struct textutil {
+	char *name;
+	int (*parse)(char **argv, struct opts *o);
+	int (*run)(struct opts *o);
+} textutils[] = {
+	{ "wc", parse_wc, wc },
+	{ "grep", parse_grep, grep },
+	{ "head", parse_headtail, head },
+	{ "tail", parse_headtail, tail },
+	{ 0, 0, 0 }
+};
+
+static struct textutil *textutil_find(command_t command, struct opts *o){
+	struct textutil *tu;
+
+	if (!enabled) {
+		return 0;
+	}
+	for (tu = textutils; tu->name != 0; tu++) {
+		if (strcmp(command->argv[0], tu->name) == 0) {
+			memset(o, 0, sizeof(*o));
+			return (*tu->parse)(command->argv, o) < 0 ? 0 : tu;
+		}
+	}
+	return 0;
+}
+
+void textutil_enable(int on){
+	if (on && !enabled) {
+		kernels_init();
+	}
+	enabled = on;
+}
+
+int textutil_check(command_t command){
+	struct opts o;
+
+	return textutil_find(command, &o) != 0;
+}
+
+int textutil_run(command_t command){
+	struct opts o;
+	struct textutil *tu = textutil_find(command, &o);
+
+	readers_sync();			// standard input may be a 'while read' loop's
+	return (*tu->run)(&o);
+}
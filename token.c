@@ -5,31 +5,46 @@
  *	- spaces, tabs, carriage returns, and null characters separate tokens
  *	  and are otherwise ignored
  *	- special characters, each a token are:
- *		newline (\n), ';', '<', '>', '&', '{', '}',
+ *		newline (\n), ';', '<', '>', '&', '|', '{', '}',
  *	- any contiguous sequence of remaining characters are returned as
  *		string tokens
  *	- the EOF token is returned (indefinitely) once the end-of-file
  *		has been reached.
  *
+ * A '#' at the start of a token starts a comment, which runs to the end
+ * of the line.  This also skips the '#!' line of a script.
+ *
  * There are two forms of escaping.  Any character can be preceded by
  * a backslash to treat it as a string token character.  Also, a sequence
  * of characters can be surrounded by single or double quotes to escape
  * all those characters.
  *
+ * Outside single quotes, $NAME, $?, $$ and $0 through $9 refer to
+ * variables, and $(( ... )) is an arithmetic expression, which may
+ * contain any characters as long as its parentheses are balanced.
+ * ${ ... } is a parameter expansion such as ${NAME%.c}; inside it only
+ * $ and backslash are special, and it cannot be nested.
+ * The tokenizer marks these in the string with the CTL_* characters
+ * from shall.h, and they are expanded when the command is executed.
+ * Control characters in the input itself are escaped with CTL_ESC.
+ *
  * The interface is as follows:
  *	tokenizer_t tokenizer_create(char (*getc)(void *env), void *env):
  *		Create a tokenizer that reads characters using the provided
  *		getc(env) function.
  *
- *	token_t tokenizer_next(tokenizer_t tokenizer):
- *		Return the next token.
+ *	void tokenizer_next(tokenizer_t tokenizer, token_t token):
+ *		Fill in the next token.  A string token is marked glued if no
+ *		space separates it from the token before it, as in '&group=x'.
  *
- *	void token_free(token_t token):
- *		Release the memory allocated for a token.
+ *	void token_release(token_t token):
+ *		Release the memory allocated for the string of a token.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
 #include <assert.h>
 #include "shall.h"
 
@@ -39,24 +54,46 @@ struct tokenizer {
 	reader_t reader;
 	enum {
 		TOKENIZER_NEUTRAL,		// normal state: awaiting more input
-		TOKENIZER_BUFFERED,		// character buffered for future processing
 		TOKENIZER_ESC,			// after reading backslash
 		TOKENIZER_SQ_STRING,	// in single quated string
 		TOKENIZER_DQ_STRING,	// in double quated string
+		TOKENIZER_DOLLAR,		// after reading $
+		TOKENIZER_VAR,			// in the name of a variable
+		TOKENIZER_PAREN,		// after reading $(
+		TOKENIZER_ARITH,		// in $(( expression
+		TOKENIZER_ARITH_CLOSE,	// after ) that may end the expression
+		TOKENIZER_BRACE,		// in ${ parameter expansion
+		TOKENIZER_BRACE_ESC,	// after backslash in parameter expansion
+		TOKENIZER_COMMENT,		// after # up to the end of the line
 		TOKENIZER_EOF			// EOF reached
-	} state;//state is one of these things
+	} state, dollar;//state is one of these things; dollar is the state to return to after $
+	int brace;					// state to return to after ${ ... }
+	int depth;					// parentheses open in an arithmetic expression
+	int hasbuffered;			// a character is buffered for future processing
 	char buffered;				// buffered character
+	int instring;				// a string is being read
+	int space;					// a space came after the last token
+	int glued;					// the string being read follows a token
 	char *string;				// string being read
 	unsigned int strlen;		// size of string
+	unsigned int maxstr;		// allocated size of string
 };
 
-/* Release a token.
+/* Release a string that may have been allocated on the heap.
+ */
+void sstring_free(struct sstring *s){
+	if (s->len >= SSTRING_INLINE) {
+		mem_free(s->u.ptr);
+	}
+	s->len = 0;
+}
+
+/* Release the string of a token.
  */
-void token_free(token_t token){
-	if (token->u.string != 0) {
-		free(token->u.string);
+void token_release(token_t token){
+	if (token->type == TOKEN_STRING) {
+		sstring_free(&token->string);
 	}
-	free(token);
 }
 
 /* Allocate a fresh tokenizer, which reads tokens from standard input.
@@ -64,80 +101,111 @@ void token_free(token_t token){
 tokenizer_t tokenizer_create(reader_t reader){
 	tokenizer_t tokenizer;
 
-	tokenizer = (tokenizer_t) calloc(1, sizeof(*tokenizer));
+	tokenizer = (tokenizer_t) mem_calloc(MEM_TOKEN, sizeof(*tokenizer));
 	tokenizer->reader = reader;
 	return tokenizer;
 }
 
-/* Append a character to the tokenizer string.
+/* Append a character to the tokenizer string.  The buffer is kept
+ * between tokens and grows by doubling.
  */
 static void tokenizer_append(struct tokenizer *tokenizer, char c){
-	tokenizer->string = realloc(tokenizer->string, tokenizer->strlen + 1);
+	if (tokenizer->strlen == tokenizer->maxstr) {
+		tokenizer->maxstr = tokenizer->maxstr == 0 ? 64 : tokenizer->maxstr * 2;
+		tokenizer->string = mem_realloc(MEM_TOKEN, tokenizer->string, tokenizer->maxstr);
+	}
 	tokenizer->string[tokenizer->strlen++] = c;
+	if (!tokenizer->instring) {
+		tokenizer->glued = !tokenizer->space;
+		tokenizer->instring = 1;
+	}
+}
+
+/* Append a character from the input, escaping it if it could be
+ * mistaken for an expansion marker.
+ */
+static void tokenizer_literal(struct tokenizer *tokenizer, char c){
+	if (c > 0 && c <= CTL_MAX) {
+		tokenizer_append(tokenizer, CTL_ESC);
+	}
+	tokenizer_append(tokenizer, c);
+}
+
+/* Process the given character again, in the state that $ was found in.
+ */
+static void tokenizer_reprocess(struct tokenizer *tokenizer, char c){
+	tokenizer->state = tokenizer->dollar;
+	tokenizer->hasbuffered = 1;
+	tokenizer->buffered = c;
 }
 
-/* Return a null-terminated string token.
+/* Return a null-terminated string token.  Short strings are copied
+ * into the token itself.
  */
-static token_t tokenizer_string(struct tokenizer *tokenizer){
+static void tokenizer_string(struct tokenizer *tokenizer, token_t token){
+	unsigned int len = tokenizer->strlen;
+
 	tokenizer_append(tokenizer, 0);
-	token_t token = calloc(1, sizeof(*token));
 	token->type = TOKEN_STRING;
-	token->u.string = tokenizer->string;
-	tokenizer->string = 0;
+	token->glued = tokenizer->glued;
+	token->string.len = len;
+	if (len < SSTRING_INLINE) {
+		memcpy(token->string.u.buf, tokenizer->string, len + 1);
+	}
+	else {
+		token->string.u.ptr = mem_alloc(MEM_TOKEN, len + 1);
+		memcpy(token->string.u.ptr, tokenizer->string, len + 1);
+	}
+	tokenizer->instring = 0;
+	tokenizer->space = 0;
 	tokenizer->strlen = 0;
 	tokenizer->state = TOKENIZER_NEUTRAL;
-	return token;
 }
 
 /* Return the given token type if there are no characters buffered.  Otherwise
  * return the string and buffer the character for future processing.
  */
-static token_t tokenizer_buffer(struct tokenizer *tokenizer, char c, enum token_type tt){
-	if (tokenizer->string == 0) {
-		token_t token = calloc(1, sizeof(*token));
+static void tokenizer_buffer(struct tokenizer *tokenizer, token_t token, char c, enum token_type tt){
+	if (!tokenizer->instring) {
 		token->type = tt;
-		return token;
+		tokenizer->space = 0;
 	}
 	else {
-		token_t token = tokenizer_string(tokenizer);
-		tokenizer->state = TOKENIZER_BUFFERED;
+		tokenizer_string(tokenizer, token);
+		tokenizer->hasbuffered = 1;
 		tokenizer->buffered = c;
-		return token;
 	}
 }
 
 /* EOF has been reached.  If there is a string buffered, return that
  * first.  Otherwise return an EOF token.
  */
-static token_t tokenizer_eof(struct tokenizer *tokenizer){
+static void tokenizer_eof(struct tokenizer *tokenizer, token_t token){
 	assert(tokenizer->state != TOKENIZER_EOF);
-	tokenizer->state = TOKENIZER_EOF;
-	if (tokenizer->string == 0) {
-		token_t token = calloc(1, sizeof(*token));
+	if (!tokenizer->instring) {
 		token->type = TOKEN_EOF;
-		return token;
 	}
 	else {
-		return tokenizer_string(tokenizer);
+		tokenizer_string(tokenizer, token);
 	}
+	tokenizer->state = TOKENIZER_EOF;
 }
 
-/* Get the next token from the tokenizer.  Tokens should be released
- * with token_free().
+/* Get the next token from the tokenizer.  The string of a token should
+ * be released with token_release().
  */
-token_t tokenizer_next(tokenizer_t tokenizer){
+void tokenizer_next(tokenizer_t tokenizer, token_t token){
 	if (tokenizer->state == TOKENIZER_EOF) {
-		token_t token = calloc(1, sizeof(*token));
 		token->type = TOKEN_EOF;
-		return token;
+		return;
 	}
 
 	for (;;) {
 		char c;
 
-		if (tokenizer->state == TOKENIZER_BUFFERED) {
+		if (tokenizer->hasbuffered) {
 			c = tokenizer->buffered;
-			tokenizer->state = TOKENIZER_NEUTRAL;
+			tokenizer->hasbuffered = 0;
 		}
 		else {
 			c = reader_next(tokenizer->reader);
@@ -149,26 +217,39 @@ token_t tokenizer_next(tokenizer_t tokenizer){
 		case TOKENIZER_NEUTRAL:
 			switch (c) {
 			case EOF:
-				return tokenizer_eof(tokenizer);
-				break;
+				tokenizer_eof(tokenizer, token);
+				return;
 			case '<':
-				return tokenizer_buffer(tokenizer, c, TOKEN_LT);
+				tokenizer_buffer(tokenizer, token, c, TOKEN_LT);
+				return;
 			case '>':
-				return tokenizer_buffer(tokenizer, c, TOKEN_GT);
+				tokenizer_buffer(tokenizer, token, c, TOKEN_GT);
+				return;
 			case '&':
-				return tokenizer_buffer(tokenizer, c, TOKEN_AMPERSAND);
+				tokenizer_buffer(tokenizer, token, c, TOKEN_AMPERSAND);
+				return;
+			case '|':
+				tokenizer_buffer(tokenizer, token, c, TOKEN_PIPE);
+				return;
 			case '{':
-				return tokenizer_buffer(tokenizer, c, TOKEN_CB_OPEN);
+				tokenizer_buffer(tokenizer, token, c, TOKEN_CB_OPEN);
+				return;
 			case '}':
-				return tokenizer_buffer(tokenizer, c, TOKEN_CB_CLOSE);
+				tokenizer_buffer(tokenizer, token, c, TOKEN_CB_CLOSE);
+				return;
 			case ';':
-				return tokenizer_buffer(tokenizer, c, TOKEN_SEMI);
+				tokenizer_buffer(tokenizer, token, c, TOKEN_SEMI);
+				return;
 			case '\n':
-				return tokenizer_buffer(tokenizer, c, TOKEN_EOLN);
+				tokenizer_buffer(tokenizer, token, c, TOKEN_EOLN);
+				return;
 			case ' ': case '\t': case '\r': case 0:
-				if (tokenizer->string != 0) {
-					return tokenizer_string(tokenizer);
+				if (tokenizer->instring) {
+					tokenizer_string(tokenizer, token);
+					tokenizer->space = 1;
+					return;
 				}
+				tokenizer->space = 1;
 				break;
 			case '\\':
 				tokenizer->state = TOKENIZER_ESC;
@@ -179,41 +260,183 @@ token_t tokenizer_next(tokenizer_t tokenizer){
 			case '"':
 				tokenizer->state = TOKENIZER_DQ_STRING;
 				break;
+			case '$':
+				tokenizer->dollar = TOKENIZER_NEUTRAL;
+				tokenizer->state = TOKENIZER_DOLLAR;
+				break;
+			case '#':
+				if (!tokenizer->instring) {
+					tokenizer->state = TOKENIZER_COMMENT;
+					break;
+				}
+				/* FALLTHROUGH */
 			default:
-				tokenizer_append(tokenizer, c);
+				tokenizer_literal(tokenizer, c);
+			}
+			break;
+		case TOKENIZER_COMMENT:
+			if (c == '\n' || c == EOF) {
+				tokenizer->state = TOKENIZER_NEUTRAL;
+				tokenizer->hasbuffered = 1;
+				tokenizer->buffered = c;
 			}
 			break;
 		case TOKENIZER_ESC:
 			if (c == EOF) {
-				return tokenizer_eof(tokenizer);
+				tokenizer_eof(tokenizer, token);
+				return;
 			}
 			else {
 				tokenizer->state = TOKENIZER_NEUTRAL;
-				tokenizer_append(tokenizer, c);
+				tokenizer_literal(tokenizer, c);
 			}
 			break;
 		case TOKENIZER_SQ_STRING:
 			switch (c) {
 			case EOF:
-				return tokenizer_eof(tokenizer);
+				tokenizer_eof(tokenizer, token);
+				return;
 			case '\'':
 				tokenizer->state = TOKENIZER_NEUTRAL;
 				break;
 			default:
-				tokenizer_append(tokenizer, c);
+				tokenizer_literal(tokenizer, c);
 			}
 			break;
 		case TOKENIZER_DQ_STRING:
 			switch (c) {
 			case EOF:
-				return tokenizer_eof(tokenizer);
+				tokenizer_eof(tokenizer, token);
+				return;
 			case '"':
 				tokenizer->state = TOKENIZER_NEUTRAL;
 				break;
+			case '$':
+				tokenizer->dollar = TOKENIZER_DQ_STRING;
+				tokenizer->state = TOKENIZER_DOLLAR;
+				break;
+			default:
+				tokenizer_literal(tokenizer, c);
+			}
+			break;
+		case TOKENIZER_DOLLAR:
+			if (isalpha((unsigned char) c) || c == '_') {
+				tokenizer_append(tokenizer, CTL_VAR);
+				tokenizer_append(tokenizer, c);
+				tokenizer->state = TOKENIZER_VAR;
+			}
+			else if (c == '(') {
+				tokenizer->state = TOKENIZER_PAREN;
+			}
+			else if (c == '{' && tokenizer->dollar != TOKENIZER_BRACE) {
+				tokenizer_append(tokenizer, CTL_PARAM);
+				tokenizer->brace = tokenizer->dollar;
+				tokenizer->state = TOKENIZER_BRACE;
+			}
+			else if (isdigit((unsigned char) c) || c == '?' || c == '$') {
+				tokenizer_append(tokenizer, CTL_VAR);
+				tokenizer_append(tokenizer, c);
+				tokenizer_append(tokenizer, CTL_END);
+				tokenizer->state = tokenizer->dollar;
+			}
+			else {
+				tokenizer_literal(tokenizer, '$');
+				tokenizer_reprocess(tokenizer, c);
+			}
+			break;
+		case TOKENIZER_PAREN:
+			if (c == '(') {
+				tokenizer_append(tokenizer, CTL_ARITH);
+				tokenizer->depth = 0;
+				tokenizer->state = TOKENIZER_ARITH;
+			}
+			else {
+				tokenizer_literal(tokenizer, '$');
+				tokenizer_literal(tokenizer, '(');
+				tokenizer_reprocess(tokenizer, c);
+			}
+			break;
+		case TOKENIZER_ARITH:
+			switch (c) {
+			case EOF:
+				tokenizer_append(tokenizer, CTL_END);
+				tokenizer_reprocess(tokenizer, c);
+				break;
+			case '(':
+				tokenizer->depth++;
+				tokenizer_append(tokenizer, c);
+				break;
+			case ')':
+				if (tokenizer->depth == 0) {
+					tokenizer->state = TOKENIZER_ARITH_CLOSE;
+				}
+				else {
+					tokenizer->depth--;
+					tokenizer_append(tokenizer, c);
+				}
+				break;
+			default:
+				tokenizer_literal(tokenizer, c);
+			}
+			break;
+		case TOKENIZER_ARITH_CLOSE:
+			if (c == ')') {
+				tokenizer_append(tokenizer, CTL_END);
+				tokenizer->state = tokenizer->dollar;
+			}
+			else {
+				tokenizer_append(tokenizer, ')');
+				tokenizer->state = TOKENIZER_ARITH;
+				tokenizer->hasbuffered = 1;
+				tokenizer->buffered = c;
+			}
+			break;
+		case TOKENIZER_BRACE:
+			switch (c) {
+			case EOF:
+				tokenizer_append(tokenizer, CTL_END);
+				tokenizer->state = tokenizer->brace;
+				tokenizer->hasbuffered = 1;
+				tokenizer->buffered = c;
+				break;
+			case '}':
+				tokenizer_append(tokenizer, CTL_END);
+				tokenizer->state = tokenizer->brace;
+				break;
+			case '\\':
+				tokenizer->state = TOKENIZER_BRACE_ESC;
+				break;
+			case '$':
+				tokenizer->dollar = TOKENIZER_BRACE;
+				tokenizer->state = TOKENIZER_DOLLAR;
+				break;
 			default:
+				tokenizer_literal(tokenizer, c);
+			}
+			break;
+		case TOKENIZER_BRACE_ESC:
+			/* Always escaped, so that for example \/ is not taken for
+			 * the separator in ${NAME/pattern/replacement}.
+			 */
+			tokenizer->state = TOKENIZER_BRACE;
+			if (c == EOF) {
+				tokenizer->hasbuffered = 1;
+				tokenizer->buffered = c;
+			}
+			else {
+				tokenizer_append(tokenizer, CTL_ESC);
 				tokenizer_append(tokenizer, c);
 			}
 			break;
+		case TOKENIZER_VAR:
+			if (isalnum((unsigned char) c) || c == '_') {
+				tokenizer_append(tokenizer, c);
+			}
+			else {
+				tokenizer_append(tokenizer, CTL_END);
+				tokenizer_reprocess(tokenizer, c);
+			}
+			break;
 		default:
 			fprintf(stderr, "tokenizer state = %d\n", tokenizer->state);
 			assert(0);
@@ -222,5 +445,6 @@ token_t tokenizer_next(tokenizer_t tokenizer){
 }
 
 void tokenizer_free(tokenizer_t tokenizer){
-	free(tokenizer);
+	mem_free(tokenizer->string);
+	mem_free(tokenizer);
 }
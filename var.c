@@ -0,0 +1,135 @@
+/* Shell variables.
+ *
+ * Variables live in a hash table with chaining.  Looking up a variable
+ * that has not been set falls back to the environment, so that $HOME
+ * and friends work as expected.
+ *
+ * The interface is as follows:
+ *	char *var_get(const char *name, unsigned int len):
+ *		Return the value of the variable with the given name, or 0.
+ *
+ *	void var_set(const char *name, const char *value):
+ *		Set a variable.
+ *
+ *	void var_unset(const char *name):
+ *		Remove a variable.
+ *
+ *	void var_clear():
+ *		Remove all variables.
+ *
+ *	int var_name(const char *name, unsigned int len):
+ *		Return 1 if the string is a valid variable name.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "shall.h"
+
+#define VAR_BUCKETS		256
+
+struct var {
+	struct var *next;
+	char *value;
+	unsigned int size;		// allocated size of value
+	unsigned int len;
+	char name[1];			// allocated with the structure
+};
+
+static struct var *vars[VAR_BUCKETS];
+
+static unsigned int var_hash(const char *name, unsigned int len){
+	unsigned int h = 5381;
+
+	while (len-- > 0) {
+		h = h * 33 + (unsigned char) *name++;
+	}
+	return h % VAR_BUCKETS;
+}
+
+static struct var **var_find(const char *name, unsigned int len){
+	struct var **pv;
+
+	for (pv = &vars[var_hash(name, len)]; *pv != 0; pv = &(*pv)->next) {
+		if ((*pv)->len == len && memcmp((*pv)->name, name, len) == 0) {
+			break;
+		}
+	}
+	return pv;
+}
+
+char *var_get(const char *name, unsigned int len){
+	struct var *v = *var_find(name, len);
+
+	if (v != 0) {
+		return v->value;
+	}
+
+	char key[len + 1];
+	memcpy(key, name, len);
+	key[len] = 0;
+	return getenv(key);
+}
+
+void var_set(const char *name, const char *value){
+	unsigned int len = strlen(name);
+	struct var **pv = var_find(name, len);
+
+	if (*pv == 0) {
+		struct var *v = mem_alloc(MEM_VAR, sizeof(*v) + len);
+		memcpy(v->name, name, len + 1);
+		v->len = len;
+		v->value = 0;
+		v->size = 0;
+		v->next = 0;
+		*pv = v;
+	}
+
+	/* Loop counters are set over and over; reuse the old value's storage.
+	 */
+	unsigned int size = strlen(value) + 1;
+	if (size > (*pv)->size) {
+		mem_free((*pv)->value);
+		(*pv)->size = size < 32 ? 32 : size;
+		(*pv)->value = mem_alloc(MEM_VAR, (*pv)->size);
+	}
+	memcpy((*pv)->value, value, size);
+}
+
+void var_unset(const char *name){
+	struct var **pv = var_find(name, strlen(name));
+	struct var *v = *pv;
+
+	if (v != 0) {
+		*pv = v->next;
+		mem_free(v->value);
+		mem_free(v);
+	}
+}
+
+void var_clear(){
+	int i;
+
+	for (i = 0; i < VAR_BUCKETS; i++) {
+		while (vars[i] != 0) {
+			struct var *v = vars[i];
+			vars[i] = v->next;
+			mem_free(v->value);
+			mem_free(v);
+		}
+	}
+}
+
+int var_name(const char *name, unsigned int len){
+	unsigned int i;
+
+	if (len == 0 || isdigit((unsigned char) name[0])) {
+		return 0;
+	}
+	for (i = 0; i < len; i++) {
+		if (!isalnum((unsigned char) name[i]) && name[i] != '_') {
+			return 0;
+		}
+	}
+	return 1;
+}